@@ -4,42 +4,1105 @@
 #include <linux/sched.h>
 #include <linux/string.h>
 #include <linux/sched/signal.h>   //Includes for_each_process()
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/hashtable.h>
+#include <linux/stringhash.h>
+#include <linux/tracepoint.h>
+#include <linux/binfmts.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/timekeeping.h>
+#include <linux/sched/mm.h>
+#include <linux/sched/task.h>
+#include <linux/workqueue.h>
+#include "findtask.h"
+#include "matcher.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Javier Vega");
 MODULE_DESCRIPTION("Finds the pid of a process given its name.");
 MODULE_VERSION("1.00");
 
-static char *name = "none";
-module_param(name, charp, S_IRUGO);
-MODULE_PARM_DESC(name, "The name of the process to find");  
+#define FIND_TASK_HASH_BITS 12   ///< 4096 buckets per table, a few tasks per bucket on busy hosts
+#define FIND_TASK_MAX_NAMES 256  ///< Most names or patterns in one query
+#define FIND_TASK_QUERY_HASH_BITS 7
+#define FIND_TASK_PROC_NAME "findtask"
+#define FIND_TASK_SEPARATORS " ,\t\n"
+#define FIND_TASK_SNAPSHOT_PROC_NAME "findtask_snapshot"
+#define FIND_TASK_SNAPSHOT_SLACK 64   ///< Room for processes forked between counting and copying
+#define FIND_TASK_CMDLINE_PREFIX "cmdline:"
+#define FIND_TASK_GLOB_CHARACTERS "*?[\\"
 
-static int __init find_task_init(void) {
+static int find_task_set_name(const char *value, const struct kernel_param *kp);
+static int find_task_set_names(const char *value, const struct kernel_param *kp);
+static int find_task_get_names(char *buffer, const struct kernel_param *kp);
+static void find_task_free_names(void *arg);
+
+static const struct kernel_param_ops name_ops = {
+  .set = find_task_set_name,
+  .get = param_get_charp,
+  .free = param_free_charp
+};
+
+static char *name;
+module_param_cb(name, &name_ops, &name, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(name, "The name of the process to find, writing it runs a new lookup");
+
+static const struct kernel_param_ops names_ops = {
+  .set = find_task_set_names,
+  .get = find_task_get_names,
+  .free = find_task_free_names
+};
+
+static char *names[FIND_TASK_MAX_NAMES];
+static unsigned int number_of_names;
+
+/// Same layout module_param_array() builds, so names=a,b,c works as usual
+static const struct kparam_array names_array = {
+  .max = FIND_TASK_MAX_NAMES,
+  .elemsize = sizeof(names[0]),
+  .num = &number_of_names,
+  .ops = &param_ops_charp,
+  .elem = names
+};
+module_param_cb(names, &names_ops, &names_array, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(names, "Comma separated names, globs or cmdline: globs of processes to find in one lookup, writing it runs a new lookup");
+
+/**
+ * One process in the index. Processes are the thread group leaders that
+ * for_each_process() visits, so every entry is keyed by its tgid.
+ */
+struct find_task_entry
+{
+  struct hlist_node by_name;            ///< Bucket in find_task_names
+  struct hlist_node by_pid;             ///< Bucket in find_task_pids
+  pid_t pid;
+  char comm[TASK_COMM_LEN];
+};
+
+/**
+ * The comm -> pid index and the pid -> entry table the tracepoint probes
+ * use to find what to update. The probes run in process context but with
+ * preemption disabled, so they allocate with GFP_ATOMIC. Nothing takes the
+ * lock from interrupts, so it does not disable them.
+ */
+static DEFINE_HASHTABLE(find_task_names, FIND_TASK_HASH_BITS);
+static DEFINE_HASHTABLE(find_task_pids, FIND_TASK_HASH_BITS);
+static DEFINE_SPINLOCK(find_task_lock);
+static struct kmem_cache *find_task_cache;
+
+/// Set when a probe could not allocate an entry; lookups then walk the task list until resync_work fills the gap
+static bool index_incomplete;
+/// Allocations that failed so far, so a resync can tell whether more failed while it ran
+static unsigned long index_misses;
+/// Set once find_task_init() has built the index, cleared before it is freed
+static bool index_ready;
+
+static void find_task_resync(struct work_struct *work);
+static DECLARE_DELAYED_WORK(resync_work, find_task_resync);
+
+static u32 hash_comm(const char *comm)
+{
+  return full_name_hash(NULL, comm, strnlen(comm, TASK_COMM_LEN));
+}
+
+static struct find_task_entry *find_entry_by_pid(pid_t pid)
+{
+  struct find_task_entry *entry;
+
+  hash_for_each_possible(find_task_pids, entry, by_pid, pid) {
+    if(entry->pid == pid)
+      return entry;
+  }
+
+  return NULL;
+}
+
+/**
+ * Adds pid to the index or moves it to a new name.
+ * Must be called with find_task_lock held.
+ */
+static void index_task(pid_t pid, const char *comm)
+{
+  struct find_task_entry *entry = find_entry_by_pid(pid);
+
+  if(entry)
+  {
+    hash_del(&entry->by_name);
+  }
+  else
+  {
+    entry = kmem_cache_alloc(find_task_cache, GFP_ATOMIC);
+    if(!entry)
+    {
+      // Retried a second later, when memory may be less tight
+      index_incomplete = true;
+      index_misses++;
+      schedule_delayed_work(&resync_work, HZ);
+      return;
+    }
+    entry->pid = pid;
+    hash_add(find_task_pids, &entry->by_pid, pid);
+  }
+
+  strscpy(entry->comm, comm, TASK_COMM_LEN);
+  hash_add(find_task_names, &entry->by_name, hash_comm(entry->comm));
+}
+
+/**
+ * Must be called with find_task_lock held.
+ */
+static void unindex_task(pid_t pid)
+{
+  struct find_task_entry *entry = find_entry_by_pid(pid);
+
+  if(entry)
+  {
+    hash_del(&entry->by_name);
+    hash_del(&entry->by_pid);
+    kmem_cache_free(find_task_cache, entry);
+  }
+}
+
+static void probe_process_fork(void *data, struct task_struct *parent, struct task_struct *child)
+{
+  // New threads are not processes of their own
+  if(!thread_group_leader(child))
+    return;
+
+  spin_lock(&find_task_lock);
+  index_task(child->pid, child->comm);
+  spin_unlock(&find_task_lock);
+}
+
+static void probe_process_exec(void *data, struct task_struct *task, pid_t old_pid, struct linux_binprm *bprm)
+{
+  // exec has made the calling thread the group leader and given it the new name
+  spin_lock(&find_task_lock);
+  index_task(task->tgid, task->comm);
+  spin_unlock(&find_task_lock);
+}
+
+static void probe_process_exit(void *data, struct task_struct *task)
+{
+  // do_exit() drops signal->live before this tracepoint, the last thread out sees 0
+  if(atomic_read(&task->signal->live) != 0)
+    return;
+
+  spin_lock(&find_task_lock);
+  unindex_task(task->tgid);
+  spin_unlock(&find_task_lock);
+}
+
+static void probe_task_rename(void *data, struct task_struct *task, const char *comm)
+{
+  // Fires before task->comm changes, so use the new name from the arguments
+  if(!thread_group_leader(task))
+    return;
+
+  spin_lock(&find_task_lock);
+  index_task(task->pid, comm);
+  spin_unlock(&find_task_lock);
+}
+
+/**
+ * The scheduler tracepoints are not exported to modules, so they are looked
+ * up by name with for_each_kernel_tracepoint().
+ */
+struct find_task_probe
+{
+  const char *name;
+  void *probe;
+  struct tracepoint *tracepoint;
+};
+
+static struct find_task_probe find_task_probes[] = {
+  { "sched_process_fork", probe_process_fork },
+  { "sched_process_exec", probe_process_exec },
+  { "sched_process_exit", probe_process_exit },
+  { "task_rename", probe_task_rename }
+};
+
+static void match_tracepoint(struct tracepoint *tracepoint, void *private)
+{
+  int i;
+
+  for(i = 0; i < ARRAY_SIZE(find_task_probes); i++) {
+    if(!strcmp(tracepoint->name, find_task_probes[i].name))
+      find_task_probes[i].tracepoint = tracepoint;
+  }
+}
+
+static void unregister_probes(void)
+{
+  int i;
+
+  for(i = 0; i < ARRAY_SIZE(find_task_probes); i++) {
+    if(find_task_probes[i].tracepoint)
+      tracepoint_probe_unregister(find_task_probes[i].tracepoint, find_task_probes[i].probe, NULL);
+  }
+
+  // No probe may still be running once this returns
+  tracepoint_synchronize_unregister();
+}
+
+static int register_probes(void)
+{
+  int i, error_number;
+
+  for_each_kernel_tracepoint(match_tracepoint, NULL);
+
+  for(i = 0; i < ARRAY_SIZE(find_task_probes); i++) {
+    if(!find_task_probes[i].tracepoint)
+    {
+      printk(KERN_ALERT "FindTask: Tracepoint %s not found\n", find_task_probes[i].name);
+      error_number = -ENOENT;
+      break;
+    }
+
+    error_number = tracepoint_probe_register(find_task_probes[i].tracepoint, find_task_probes[i].probe, NULL);
+    if(error_number < 0)
+    {
+      printk(KERN_ALERT "FindTask: Failed to attach to %s\n", find_task_probes[i].name);
+      break;
+    }
+  }
+
+  if(i < ARRAY_SIZE(find_task_probes))
+  {
+    // Only detach the probes that were attached
+    for(; i < ARRAY_SIZE(find_task_probes); i++)
+      find_task_probes[i].tracepoint = NULL;
+    unregister_probes();
+    return error_number;
+  }
+
+  return 0;
+}
+
+/**
+ * Fills the index with the processes that already exist. The probes are
+ * registered first so nothing that happens during the walk is missed; an
+ * entry a probe already made is newer than what the walk sees and is kept.
+ * Checking signal->live under the lock keeps the walk from adding back a
+ * process whose exit probe has already run.
+ */
+static void build_index(void)
+{
   struct task_struct *current_task;
-  int found = 0;
-  pid_t pid = 0; 
 
-  // Traverses the list of tasks until we find the process we are looking for.
+  rcu_read_lock();
   for_each_process(current_task) {
-    if(!strcmp(name, current_task->comm))
+    spin_lock(&find_task_lock);
+    if(atomic_read(&current_task->signal->live) > 0 && !find_entry_by_pid(current_task->pid))
+      index_task(current_task->pid, current_task->comm);
+    spin_unlock(&find_task_lock);
+  }
+  rcu_read_unlock();
+}
+
+/**
+ * Walks the task list again after an entry could not be allocated, adding
+ * the processes that are missing. Lookups use the index again only when no
+ * allocation failed while the walk ran.
+ */
+static void find_task_resync(struct work_struct *work)
+{
+  unsigned long misses;
+
+  spin_lock(&find_task_lock);
+  misses = index_misses;
+  spin_unlock(&find_task_lock);
+
+  build_index();
+
+  spin_lock(&find_task_lock);
+  if(index_misses == misses)
+    index_incomplete = false;
+  spin_unlock(&find_task_lock);
+}
+
+/**
+ * Makes name and names writes only store the names again, and waits for a
+ * lookup such a write already started: the parameter store runs under
+ * kernel_param_lock(). Called before the index is freed.
+ */
+static void stop_lookups(void)
+{
+  kernel_param_lock(THIS_MODULE);
+  index_ready = false;
+  kernel_param_unlock(THIS_MODULE);
+}
+
+static void free_index(void)
+{
+  struct find_task_entry *entry;
+  struct hlist_node *next;
+  int bucket;
+
+  hash_for_each_safe(find_task_pids, bucket, next, entry, by_pid) {
+    hash_del(&entry->by_name);
+    hash_del(&entry->by_pid);
+    kmem_cache_free(find_task_cache, entry);
+  }
+}
+
+enum
+{
+  FindTaskExact,      ///< The comm, looked up in the index
+  FindTaskGlob,       ///< A glob over the comm, "name*" for a prefix
+  FindTaskCmdline     ///< "cmdline:" and a glob over the arguments joined by spaces
+};
+
+/**
+ * One name or pattern of a query and how many processes were found with it.
+ */
+struct find_task_name
+{
+  struct hlist_node node;
+  const char *name;           ///< As written, which is also how answers are labeled
+  const char *pattern;        ///< What is matched, name without any "cmdline:"
+  int kind;
+  unsigned int matches;
+};
+
+/**
+ * The names of a query in a small hash set, so a walk checks every task
+ * against all exact names with one hash lookup. Globs over the comm and
+ * over the command line are each compiled into one matcher, so a task
+ * costs one pass over its comm (and its command line) however many
+ * patterns there are.
+ */
+struct find_task_query
+{
+  DECLARE_HASHTABLE(names, FIND_TASK_QUERY_HASH_BITS);
+  unsigned int count;
+  struct find_task_name entries[FIND_TASK_MAX_NAMES + 1];
+
+  struct matcher *comm_matcher;
+  struct matcher *cmdline_matcher;
+  unsigned int number_of_globs;
+  unsigned int number_of_cmdlines;
+  struct find_task_name *globs[FIND_TASK_MAX_NAMES + 1];      ///< Entry of every comm_matcher pattern
+  struct find_task_name *cmdlines[FIND_TASK_MAX_NAMES + 1];   ///< Entry of every cmdline_matcher pattern
+};
+
+static struct find_task_name *query_find(struct find_task_query *query, const char *wanted)
+{
+  struct find_task_name *entry;
+
+  hash_for_each_possible(query->names, entry, node, hash_comm(wanted)) {
+    if(!strcmp(wanted, entry->name))
+      return entry;
+  }
+
+  return NULL;
+}
+
+/**
+ * Answers go to the kernel log, or to a /proc/findtask reader when output
+ * is not NULL.
+ */
+static void report_match(struct find_task_name *entry, pid_t pid, struct seq_file *output)
+{
+  entry->matches++;
+  if(output)
+    seq_printf(output, "%s %d\n", entry->name, pid);
+  else
+    printk("Found process %s with pid %d\n", entry->name, pid);
+}
+
+static void report_not_found(struct find_task_name *entry, struct seq_file *output)
+{
+  if(output)
+    seq_printf(output, "%s not found\n", entry->name);
+  else
+    printk("Not Found process %s\n", entry->name);
+}
+
+/**
+ * What matcher_match() needs to report a matching pattern.
+ */
+struct find_task_match
+{
+  struct find_task_name **entries;
+  pid_t pid;
+  struct seq_file *output;
+};
+
+static void report_pattern(unsigned int pattern, void *private)
+{
+  struct find_task_match *match = private;
+
+  report_match(match->entries[pattern], match->pid, match->output);
+}
+
+/**
+ * Copies the command line of task into buffer with the arguments joined by
+ * spaces, like ps shows it. This reads the memory of the task, which can
+ * sleep, so it must not be called under rcu_read_lock().
+ * @return the length of the command line, 0 for kernel threads
+ */
+static size_t read_cmdline(struct task_struct *task, char *buffer, size_t size)
+{
+  struct mm_struct *mm;
+  unsigned long start, end;
+  size_t length;
+  int copied, i;
+
+  mm = get_task_mm(task);
+  if(!mm)
+    return 0;
+
+  spin_lock(&mm->arg_lock);
+  start = mm->arg_start;
+  end = mm->arg_end;
+  spin_unlock(&mm->arg_lock);
+
+  length = min_t(size_t, end - start, size);
+  copied = access_process_vm(task, start, buffer, length, FOLL_FORCE);
+  mmput(mm);
+  if(copied <= 0)
+    return 0;
+
+  for(i = 0; i < copied; i++) {
+    if(buffer[i] == '\0')
+      buffer[i] = ' ';
+  }
+  // The last argument ends in a NUL too
+  while(copied > 0 && buffer[copied - 1] == ' ')
+    copied--;
+
+  return copied;
+}
+
+/**
+ * Matches the processes collected by scan_tasks() against the command
+ * line patterns, now outside the RCU read section, and drops their
+ * references.
+ */
+static int match_cmdlines(struct find_task_query *query, struct task_struct **tasks, size_t count,
+                          struct seq_file *output)
+{
+  struct find_task_match match = { .entries = query->cmdlines, .output = output };
+  char *buffer;
+  size_t i, length;
+
+  buffer = kmalloc(PAGE_SIZE, GFP_KERNEL);
+  for(i = 0; i < count; i++) {
+    if(buffer)
     {
-      pid = current_task->pid;
-      found = 1;
+      length = read_cmdline(tasks[i], buffer, PAGE_SIZE);
+      match.pid = tasks[i]->pid;
+      matcher_match(query->cmdline_matcher, buffer, length, report_pattern, &match);
     }
+    put_task_struct(tasks[i]);
   }
+  kfree(buffer);
 
-  if(found)
-    printk("Found process %s with pid %d", name, pid);
-  else
-    printk("Not Found process %s", name);
+  return buffer ? 0 : -ENOMEM;
+}
+
+/**
+ * Answers the whole query in a single traversal of the task list: exact
+ * names through the query hash set, comm globs through one matcher. Also
+ * the fallback for plain names when the index lost an update. Processes
+ * whose command line has to be matched are only collected here, since
+ * reading it can sleep.
+ */
+static int scan_tasks(struct find_task_query *query, struct seq_file *output)
+{
+  struct find_task_match match = { .entries = query->globs, .output = output };
+  struct task_struct *current_task, **tasks = NULL;
+  struct find_task_name *entry;
+  size_t capacity = 0, count = 0;
+
+  if(query->cmdline_matcher)
+  {
+    rcu_read_lock();
+    for_each_process(current_task) {
+      capacity++;
+    }
+    rcu_read_unlock();
+    capacity += FIND_TASK_SNAPSHOT_SLACK;
+
+    tasks = kvmalloc_array(capacity, sizeof(*tasks), GFP_KERNEL);
+    if(!tasks)
+      return -ENOMEM;
+  }
+
+  rcu_read_lock();
+  for_each_process(current_task) {
+    entry = query_find(query, current_task->comm);
+    if(entry && entry->kind == FindTaskExact)
+      report_match(entry, current_task->pid, output);
+
+    if(query->comm_matcher)
+    {
+      match.pid = current_task->pid;
+      matcher_match(query->comm_matcher, current_task->comm, strnlen(current_task->comm, TASK_COMM_LEN),
+                    report_pattern, &match);
+    }
+
+    // Processes forked after the count are past the point in time of the query
+    if(tasks && count < capacity)
+    {
+      get_task_struct(current_task);
+      tasks[count++] = current_task;
+    }
+  }
+  rcu_read_unlock();
+
+  if(tasks)
+  {
+    int error_number = match_cmdlines(query, tasks, count, output);
+
+    kvfree(tasks);
+    return error_number;
+  }
+
+  return 0;
+}
+
+/**
+ * A match of an index lookup, reported once find_task_lock is dropped.
+ */
+struct find_task_hit
+{
+  struct find_task_name *entry;
+  pid_t pid;
+};
+
+/**
+ * Answers exact names from the index. The matches are only copied out
+ * under find_task_lock and reported after it is dropped, so a slow console
+ * does not hold up the probes spinning on the lock.
+ */
+static int lookup_names(struct find_task_query *query, struct seq_file *output)
+{
+  struct find_task_entry *process;
+  struct find_task_hit *hits;
+  size_t capacity = 0, count = 0, j;
+  unsigned int i;
+
+  spin_lock(&find_task_lock);
+  if(index_incomplete || query->comm_matcher || query->cmdline_matcher)
+  {
+    spin_unlock(&find_task_lock);
+    return scan_tasks(query, output);
+  }
+
+  // Every process with the name is in the same bucket
+  for(i = 0; i < query->count; i++) {
+    hash_for_each_possible(find_task_names, process, by_name, hash_comm(query->entries[i].name)) {
+      if(!strcmp(query->entries[i].name, process->comm))
+        capacity++;
+    }
+  }
+  spin_unlock(&find_task_lock);
+  capacity += FIND_TASK_SNAPSHOT_SLACK;
+
+  hits = kvmalloc_array(capacity, sizeof(*hits), GFP_KERNEL);
+  if(!hits)
+    return -ENOMEM;
+
+  spin_lock(&find_task_lock);
+  // A probe may have lost an update while the lock was dropped
+  if(index_incomplete)
+  {
+    spin_unlock(&find_task_lock);
+    kvfree(hits);
+    return scan_tasks(query, output);
+  }
+  for(i = 0; i < query->count; i++) {
+    struct find_task_name *entry = &query->entries[i];
+
+    hash_for_each_possible(find_task_names, process, by_name, hash_comm(entry->name)) {
+      // Processes that took the name after the count are past the point in time of the query
+      if(!strcmp(entry->name, process->comm) && count < capacity)
+      {
+        hits[count].entry = entry;
+        hits[count++].pid = process->pid;
+      }
+    }
+  }
+  spin_unlock(&find_task_lock);
+
+  for(j = 0; j < count; j++)
+    report_match(hits[j].entry, hits[j].pid, output);
+  kvfree(hits);
+
+  return 0;
+}
+
+/**
+ * Compiles the patterns of one kind into a matcher and remembers which
+ * entry every pattern belongs to.
+ */
+static int compile_patterns(struct find_task_query *query, int kind, struct matcher **matcher,
+                            struct find_task_name **entries, unsigned int *count)
+{
+  const char **patterns;
+  unsigned int i;
+  int error_number;
+
+  *count = 0;
+  for(i = 0; i < query->count; i++) {
+    if(query->entries[i].kind == kind)
+      entries[(*count)++] = &query->entries[i];
+  }
+  if(*count == 0)
+    return 0;
+
+  patterns = kmalloc_array(*count, sizeof(*patterns), GFP_KERNEL);
+  if(!patterns)
+    return -ENOMEM;
+  for(i = 0; i < *count; i++)
+    patterns[i] = entries[i]->pattern;
+
+  error_number = matcher_compile(patterns, *count, matcher);
+  kfree(patterns);
+
+  return error_number;
+}
+
+/**
+ * Looks up all the wanted names at once and reports every pid found for
+ * each of them. Repeated names are only looked up once. Names that contain
+ * a glob character are matched as globs against the comm, and names that
+ * start with "cmdline:" as globs against the command line.
+ */
+static int find_tasks(const char *const *wanted, unsigned int count, struct seq_file *output)
+{
+  struct find_task_query *query;
+  size_t prefix_length = strlen(FIND_TASK_CMDLINE_PREFIX);
+  unsigned int i;
+  int error_number;
+
+  query = kvzalloc(sizeof(*query), GFP_KERNEL);
+  if(!query)
+    return -ENOMEM;
+
+  hash_init(query->names);
+  for(i = 0; i < count && query->count < ARRAY_SIZE(query->entries); i++) {
+    struct find_task_name *entry = &query->entries[query->count];
+
+    if(query_find(query, wanted[i]))
+      continue;
+    entry->name = wanted[i];
+    entry->pattern = wanted[i];
+    if(!strncmp(wanted[i], FIND_TASK_CMDLINE_PREFIX, prefix_length))
+    {
+      entry->kind = FindTaskCmdline;
+      entry->pattern += prefix_length;
+    }
+    else if(strpbrk(wanted[i], FIND_TASK_GLOB_CHARACTERS))
+    {
+      entry->kind = FindTaskGlob;
+    }
+    else
+    {
+      entry->kind = FindTaskExact;
+    }
+    hash_add(query->names, &entry->node, hash_comm(entry->name));
+    query->count++;
+  }
+
+  error_number = compile_patterns(query, FindTaskGlob, &query->comm_matcher, query->globs,
+                                  &query->number_of_globs);
+  if(error_number == 0)
+    error_number = compile_patterns(query, FindTaskCmdline, &query->cmdline_matcher, query->cmdlines,
+                                    &query->number_of_cmdlines);
+  if(error_number == 0)
+    error_number = lookup_names(query, output);
+
+  if(error_number == 0)
+  {
+    for(i = 0; i < query->count; i++) {
+      if(query->entries[i].matches == 0)
+        report_not_found(&query->entries[i], output);
+    }
+  }
+  matcher_free(query->comm_matcher);
+  matcher_free(query->cmdline_matcher);
+  kvfree(query);
+
+  return error_number;
+}
+
+/**
+ * Runs a lookup every time a new name is written to
+ * /sys/module/FindTask/parameters/name, so the module does not have to be
+ * reloaded for every query. Writes that come in before the index is built
+ * only store the name; find_task_init() looks it up afterwards.
+ */
+static int find_task_set_name(const char *value, const struct kernel_param *kp)
+{
+  int error_number = param_set_charp(value, kp);
+
+  if(error_number == 0 && index_ready)
+    error_number = find_tasks((const char *const *)&name, 1, NULL);
+
+  return error_number;
+}
+
+/**
+ * Same for /sys/module/FindTask/parameters/names: writing a comma
+ * separated list looks up all of the names in one go.
+ */
+static int find_task_set_names(const char *value, const struct kernel_param *kp)
+{
+  int error_number = param_array_ops.set(value, kp);
+
+  if(error_number == 0 && index_ready)
+    error_number = find_tasks((const char *const *)names, number_of_names, NULL);
+
+  return error_number;
+}
+
+static int find_task_get_names(char *buffer, const struct kernel_param *kp)
+{
+  return param_array_ops.get(buffer, kp);
+}
+
+static void find_task_free_names(void *arg)
+{
+  param_array_ops.free(arg);
+}
+
+/**
+ * What one open of /proc/findtask last asked for. Writes replace it under
+ * the seq_file lock, which reads hold while they run the query.
+ */
+struct find_task_client
+{
+  char *query;                                ///< Written text, split in place into names
+  const char *names[FIND_TASK_MAX_NAMES];
+  unsigned int number_of_names;
+};
+
+/**
+ * Every read from the start of the file runs the last written query again,
+ * so a client can poll for the same names with pread(fd, buffer, size, 0).
+ */
+static int find_task_proc_show(struct seq_file *output, void *unused)
+{
+  struct find_task_client *client = output->private;
+
+  if(client->number_of_names == 0)
+    return 0;
+
+  return find_tasks(client->names, client->number_of_names, output);
+}
+
+static int find_task_proc_open(struct inode *inode, struct file *file)
+{
+  struct find_task_client *client;
+  int error_number;
+
+  client = kzalloc(sizeof(*client), GFP_KERNEL);
+  if(!client)
+    return -ENOMEM;
+
+  error_number = single_open(file, find_task_proc_show, client);
+  if(error_number < 0)
+    kfree(client);
+
+  return error_number;
+}
+
+static int find_task_proc_release(struct inode *inode, struct file *file)
+{
+  struct find_task_client *client = ((struct seq_file *)file->private_data)->private;
 
-  printk(KERN_INFO "");
+  kfree(client->query);
+  kfree(client);
+
+  return single_release(inode, file);
+}
+
+/**
+ * Takes the names to look up, separated by spaces, commas or newlines.
+ * Like a Testchar write, it rewinds the file so the next read returns the
+ * answers to this query.
+ */
+static ssize_t find_task_proc_write(struct file *file, const char __user *buffer, size_t count, loff_t *position)
+{
+  struct seq_file *output = file->private_data;
+  struct find_task_client *client = output->private;
+  char *query, *cursor, *token;
+
+  if(count == 0 || count >= PAGE_SIZE)
+    return -EINVAL;
+
+  query = memdup_user_nul(buffer, count);
+  if(IS_ERR(query))
+    return PTR_ERR(query);
+
+  mutex_lock(&output->lock);
+  kfree(client->query);
+  client->query = query;
+  client->number_of_names = 0;
+
+  cursor = query;
+  while((token = strsep(&cursor, FIND_TASK_SEPARATORS)) != NULL) {
+    if(*token == '\0')
+      continue;
+    if(client->number_of_names == FIND_TASK_MAX_NAMES)
+      break;
+    client->names[client->number_of_names++] = token;
+  }
+  mutex_unlock(&output->lock);
+
+  *position = 0;
+
+  return count;
+}
+
+static const struct proc_ops find_task_proc_ops = {
+  .proc_open = find_task_proc_open,
+  .proc_read = seq_read,
+  .proc_write = find_task_proc_write,
+  .proc_lseek = seq_lseek,
+  .proc_release = find_task_proc_release
+};
+
+/**
+ * Buffer of one open of /proc/findtask_snapshot. It is reused by every
+ * snapshot taken through that open, so polling does not allocate.
+ */
+struct find_task_snapshot
+{
+  struct mutex lock;        ///< Serializes readers sharing the open file
+  void *buffer;
+  size_t capacity;          ///< Number of records buffer has room for
+  size_t size;              ///< Valid bytes in buffer
+};
+
+/**
+ * Fills record from task. Called under rcu_read_lock(), so nothing here
+ * may sleep; task_lock() is a spinlock and keeps mm alive while its
+ * counters are read.
+ */
+static void fill_record(struct findtask_record *record, struct task_struct *task)
+{
+  struct task_struct *thread;
+  struct mm_struct *mm;
+  u64 cpu_time;
+
+  memset(record, 0, sizeof(*record));
+  record->pid = task->tgid;
+  record->ppid = task_tgid_nr(rcu_dereference(task->real_parent));
+  record->state = task_index_to_char(task_state_index(task));
+  record->start_time_ns = task->start_boottime;
+
+  // Threads that already exited are summed up in signal_struct
+  cpu_time = READ_ONCE(task->signal->utime) + READ_ONCE(task->signal->stime);
+  for_each_thread(task, thread) {
+    cpu_time += READ_ONCE(thread->utime) + READ_ONCE(thread->stime);
+  }
+  record->cpu_time_ns = cpu_time;
+
+  task_lock(task);
+  strscpy_pad(record->comm, task->comm, sizeof(record->comm));
+  mm = task->mm;
+  if(mm && !(task->flags & PF_KTHREAD))
+    record->rss_bytes = (u64)get_mm_rss(mm) << PAGE_SHIFT;
+  task_unlock(task);
+}
+
+/**
+ * Copies the whole process table into snapshot->buffer with one walk.
+ * The buffer is sized from a first counting walk plus some slack; if more
+ * processes than that showed up in between, it is grown and the copy is
+ * done again.
+ */
+static int take_snapshot(struct find_task_snapshot *snapshot)
+{
+  struct findtask_snapshot_header *header;
+  struct findtask_record *records;
+  struct task_struct *current_task;
+  size_t wanted = 0, count;
+  bool overflow;
+
+  rcu_read_lock();
+  for_each_process(current_task) {
+    wanted++;
+  }
+  rcu_read_unlock();
+  wanted += FIND_TASK_SNAPSHOT_SLACK;
+
+  do {
+    if(wanted > snapshot->capacity)
+    {
+      kvfree(snapshot->buffer);
+      snapshot->capacity = 0;
+      snapshot->buffer = kvmalloc(sizeof(*header) + wanted * sizeof(*records), GFP_KERNEL);
+      if(!snapshot->buffer)
+        return -ENOMEM;
+      snapshot->capacity = wanted;
+    }
+
+    header = snapshot->buffer;
+    records = (struct findtask_record *)(header + 1);
+    count = 0;
+    overflow = false;
+
+    rcu_read_lock();
+    for_each_process(current_task) {
+      if(count == snapshot->capacity)
+      {
+        overflow = true;
+        break;
+      }
+      fill_record(&records[count++], current_task);
+    }
+    rcu_read_unlock();
+
+    wanted = snapshot->capacity * 2;
+  } while(overflow);
+
+  header->magic = FINDTASK_SNAPSHOT_MAGIC;
+  header->version = FINDTASK_SNAPSHOT_VERSION;
+  header->record_size = sizeof(*records);
+  header->count = count;
+  header->reserved = 0;
+  header->timestamp_ns = ktime_get_boottime_ns();
+  snapshot->size = sizeof(*header) + count * sizeof(*records);
+
+  return 0;
+}
+
+static int find_task_snapshot_open(struct inode *inode, struct file *file)
+{
+  struct find_task_snapshot *snapshot;
+
+  snapshot = kzalloc(sizeof(*snapshot), GFP_KERNEL);
+  if(!snapshot)
+    return -ENOMEM;
+
+  mutex_init(&snapshot->lock);
+  file->private_data = snapshot;
+
+  return 0;
+}
+
+static int find_task_snapshot_release(struct inode *inode, struct file *file)
+{
+  struct find_task_snapshot *snapshot = file->private_data;
+
+  mutex_destroy(&snapshot->lock);
+  kvfree(snapshot->buffer);
+  kfree(snapshot);
+
+  return 0;
+}
+
+/**
+ * A read from offset 0 takes a new snapshot; reads further on continue
+ * the one already taken, so a short buffer can read it in pieces. Use a
+ * buffer big enough for the whole table to get it in one system call.
+ */
+static ssize_t find_task_snapshot_read(struct file *file, char __user *buffer, size_t count, loff_t *position)
+{
+  struct find_task_snapshot *snapshot = file->private_data;
+  ssize_t result;
+
+  mutex_lock(&snapshot->lock);
+  if(*position == 0 || !snapshot->buffer)
+  {
+    result = take_snapshot(snapshot);
+    if(result < 0)
+    {
+      mutex_unlock(&snapshot->lock);
+      return result;
+    }
+  }
+  result = simple_read_from_buffer(buffer, count, position, snapshot->buffer, snapshot->size);
+  mutex_unlock(&snapshot->lock);
+
+  return result;
+}
+
+static const struct proc_ops find_task_snapshot_proc_ops = {
+  .proc_open = find_task_snapshot_open,
+  .proc_read = find_task_snapshot_read,
+  .proc_lseek = default_llseek,
+  .proc_release = find_task_snapshot_release
+};
+
+static int __init find_task_init(void) {
+  const char **wanted;
+  unsigned int number_of_wanted = 0;
+  int error_number;
+
+  find_task_cache = KMEM_CACHE(find_task_entry, 0);
+  if(!find_task_cache)
+    return -ENOMEM;
+
+  error_number = register_probes();
+  if(error_number < 0)
+  {
+    kmem_cache_destroy(find_task_cache);
+    return error_number;
+  }
+  build_index();
+  index_ready = true;
+
+  // Root only, the answers cover the processes of every user
+  if(!proc_create(FIND_TASK_PROC_NAME, S_IRUSR | S_IWUSR, NULL, &find_task_proc_ops))
+  {
+    stop_lookups();
+    unregister_probes();
+    cancel_delayed_work_sync(&resync_work);
+    free_index();
+    kmem_cache_destroy(find_task_cache);
+    return -ENOMEM;
+  }
+  if(!proc_create(FIND_TASK_SNAPSHOT_PROC_NAME, S_IRUSR, NULL, &find_task_snapshot_proc_ops))
+  {
+    stop_lookups();
+    remove_proc_entry(FIND_TASK_PROC_NAME, NULL);
+    unregister_probes();
+    cancel_delayed_work_sync(&resync_work);
+    free_index();
+    kmem_cache_destroy(find_task_cache);
+    return -ENOMEM;
+  }
+
+  // One lookup for name and names together, name only when it was given
+  if(!name && number_of_names == 0)
+    return 0;
+  wanted = kmalloc_array(number_of_names + 1, sizeof(*wanted), GFP_KERNEL);
+  if(wanted)
+  {
+    if(name)
+      wanted[number_of_wanted++] = name;
+    memcpy(&wanted[number_of_wanted], names, number_of_names * sizeof(*wanted));
+    number_of_wanted += number_of_names;
+    find_tasks(wanted, number_of_wanted, NULL);
+    kfree(wanted);
+  }
 
   return 0;
 }
 static void __exit find_task_exit(void) {
+  // No parameter write or reader can start a new lookup once these return
+  stop_lookups();
+  remove_proc_entry(FIND_TASK_SNAPSHOT_PROC_NAME, NULL);
+  remove_proc_entry(FIND_TASK_PROC_NAME, NULL);
+  unregister_probes();
+  // Also stops a resync that would queue itself again
+  cancel_delayed_work_sync(&resync_work);
+  free_index();
+  kmem_cache_destroy(find_task_cache);
+
   printk(KERN_INFO "Removing FindTask module\n");
 }
 
 module_init(find_task_init);
-module_exit(find_task_exit);
\ No newline at end of file
+module_exit(find_task_exit);
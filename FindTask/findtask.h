@@ -0,0 +1,40 @@
+#ifndef FINDTASK_H
+#define FINDTASK_H
+
+/**
+ * Layout of /proc/findtask_snapshot, shared by the module and user space.
+ * A read from offset 0 takes a new snapshot of the process table: a header
+ * followed by header.count records of header.record_size bytes, one per
+ * process. Readers should step through the records by record_size, so
+ * fields added at the end in later versions do not break them.
+ */
+
+#include <linux/types.h>
+
+#define FINDTASK_SNAPSHOT_MAGIC   0x4e535446   ///< "FTSN" in a little endian dump
+#define FINDTASK_SNAPSHOT_VERSION 1
+#define FINDTASK_COMM_LEN         16
+
+struct findtask_snapshot_header
+{
+  __u32 magic;              ///< FINDTASK_SNAPSHOT_MAGIC
+  __u16 version;            ///< FINDTASK_SNAPSHOT_VERSION
+  __u16 record_size;        ///< sizeof(struct findtask_record) of the module
+  __u32 count;              ///< Number of records after the header
+  __u32 reserved;
+  __u64 timestamp_ns;       ///< CLOCK_BOOTTIME when the snapshot was taken
+};
+
+struct findtask_record
+{
+  __s32 pid;                ///< Process id (tgid)
+  __s32 ppid;               ///< Process id of the parent
+  char comm[FINDTASK_COMM_LEN];
+  __u8 state;               ///< Same letter as /proc/<pid>/stat: R, S, D, T, t, X, Z, P or I
+  __u8 reserved[7];
+  __u64 cpu_time_ns;        ///< User plus system time of all the threads
+  __u64 rss_bytes;          ///< Resident set size, 0 for kernel threads
+  __u64 start_time_ns;      ///< CLOCK_BOOTTIME when the process started
+};
+
+#endif
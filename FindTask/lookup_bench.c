@@ -0,0 +1,679 @@
+/**
+ * Compares the ways of finding the pid of a process by name as the process
+ * table grows. For every process count it starts that many idle dummy
+ * processes plus one target, and times repeated lookups of the target:
+ *
+ * - findtask_index: /proc/findtask with the exact name, answered from the
+ *   name index of the module
+ * - findtask_walk: /proc/findtask with a glob of the name, which makes the
+ *   module walk the whole process list
+ * - naive: readdir() of /proc and open/read/close of every <pid>/comm
+ * - parallel: one getdents64() pass over /proc, then worker threads reading
+ *   <pid>/comm with openat() relative to the /proc descriptor
+ *
+ * The latency distribution of every approach at every count is printed as
+ * JSON. The FindTask approaches are skipped when the module is not loaded.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#define FIND_TASK_PATH "/proc/findtask"
+#define TARGET_NAME "ftbench_target"
+#define TARGET_GLOB "ftbench_targe?"
+#define DUMMY_NAME "ftbench_dummy"
+
+#define DUMMY_STACK_SIZE (16 * 1024)    ///< A dummy only calls prctl() and pause()
+#define COMM_LENGTH 16
+#define PID_CHUNK 64                    ///< Pids a parallel worker claims at a time
+#define DIRENT_BUFFER_LENGTH (1 << 20)
+#define ANSWER_BUFFER_LENGTH (1 << 16)
+
+enum
+{
+  ApproachFindTaskIndex,
+  ApproachFindTaskWalk,
+  ApproachNaive,
+  ApproachParallel,
+  NumberOfApproaches
+};
+
+static const char *approach_names[NumberOfApproaches] = { "findtask_index", "findtask_walk", "naive", "parallel" };
+
+typedef struct benchmark_configuration_t
+{
+  unsigned int counts[32];              ///< Numbers of dummy processes, ascending
+  int number_of_counts;
+  int repetitions;
+  int number_of_threads;
+  const char *findtask_path;
+} benchmark_configuration_t;
+
+/**
+ * Pids found by one lookup. Every approach must find exactly the target.
+ */
+typedef struct lookup_result_t
+{
+  unsigned int found;
+  pid_t pid;
+  unsigned int entries;                 ///< Processes looked at, 0 when the module does not say
+} lookup_result_t;
+
+/**
+ * State shared by the parallel scanner threads. The main thread lists the
+ * pids, then the workers take chunks of them until none are left.
+ */
+typedef struct parallel_scanner_t
+{
+  int proc_descriptor;
+  pid_t *pids;
+  unsigned int number_of_pids;
+  unsigned int capacity;
+  atomic_uint next_pid;
+  atomic_uint found;
+  atomic_int found_pid;
+  int stop;
+  pthread_barrier_t start;
+  pthread_barrier_t done;
+  pthread_t *threads;
+  int number_of_threads;
+} parallel_scanner_t;
+
+static pid_t *dummies;
+static unsigned int number_of_dummies;
+static pid_t target;
+static char *dummy_stacks;
+
+static uint64_t now_in_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * Checks a comm read from /proc, which ends with a newline.
+ */
+static int is_target(const char *comm, ssize_t length)
+{
+  return length == sizeof(TARGET_NAME) && !memcmp(comm, TARGET_NAME "\n", length);
+}
+
+/**
+ * Body of a dummy. It shares the address space of the benchmark, so a
+ * hundred thousand of them cost a kernel stack and a page of user stack
+ * each instead of a copy of the page tables.
+ */
+static int run_dummy(void *name)
+{
+  prctl(PR_SET_NAME, name);
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  for(;;)
+  {
+    pause();
+  }
+
+  return 0;
+}
+
+static pid_t start_dummy(const char *name, char *stack)
+{
+  return clone(run_dummy, stack + DUMMY_STACK_SIZE, CLONE_VM | SIGCHLD, (void *)name);
+}
+
+/**
+ * Waits until the target has renamed itself, so no lookup races with it.
+ */
+static void wait_for_target(void)
+{
+  char path[64], comm[COMM_LENGTH + 1];
+  ssize_t length;
+  int descriptor;
+
+  snprintf(path, sizeof(path), "/proc/%d/comm", target);
+  do
+  {
+    length = -1;
+    descriptor = open(path, O_RDONLY);
+    if(descriptor >= 0)
+    {
+      length = read(descriptor, comm, sizeof(comm));
+      close(descriptor);
+    }
+  } while(!is_target(comm, length) && sched_yield() == 0);
+}
+
+/**
+ * Starts dummies until there are count of them.
+ * @return 0, or -1 if the system refused to create more processes
+ */
+static int grow_dummies(unsigned int count)
+{
+  pid_t pid;
+
+  while(number_of_dummies < count)
+  {
+    pid = start_dummy(DUMMY_NAME, dummy_stacks + (size_t)(number_of_dummies + 1) * DUMMY_STACK_SIZE);
+    if(pid < 0)
+    {
+      return -1;
+    }
+    dummies[number_of_dummies++] = pid;
+  }
+
+  return 0;
+}
+
+static void stop_dummies(void)
+{
+  unsigned int i;
+
+  for(i = 0; i < number_of_dummies; i++)
+  {
+    kill(dummies[i], SIGKILL);
+  }
+  if(target > 0)
+  {
+    kill(target, SIGKILL);
+  }
+  while(wait(NULL) > 0 || errno == EINTR)
+  {
+  }
+}
+
+/**
+ * Runs the query last written to /proc/findtask again and parses the
+ * "name pid" lines of the answer.
+ */
+static int lookup_findtask(int descriptor, lookup_result_t *result)
+{
+  static char answer[ANSWER_BUFFER_LENGTH];
+  ssize_t length, total = 0;
+  char *line, *end;
+
+  while((length = pread(descriptor, answer + total, sizeof(answer) - 1 - total, total)) > 0)
+  {
+    total += length;
+  }
+  if(length < 0)
+  {
+    return -1;
+  }
+  answer[total] = '\0';
+
+  for(line = answer; (end = strchr(line, '\n')) != NULL; line = end + 1)
+  {
+    char *space = strrchr(line, ' ');
+    *end = '\0';
+    if(space != NULL && strcmp(space + 1, "found"))
+    {
+      result->found++;
+      result->pid = atoi(space + 1);
+    }
+  }
+
+  return 0;
+}
+
+static int lookup_naive(lookup_result_t *result)
+{
+  char path[sizeof("/proc//comm") + sizeof(((struct dirent *)0)->d_name)], comm[COMM_LENGTH + 1];
+  struct dirent *entry;
+  DIR *directory;
+  ssize_t length;
+  int descriptor;
+
+  directory = opendir("/proc");
+  if(directory == NULL)
+  {
+    return -1;
+  }
+  while((entry = readdir(directory)) != NULL)
+  {
+    if(entry->d_name[0] < '1' || entry->d_name[0] > '9')
+    {
+      continue;
+    }
+    result->entries++;
+
+    snprintf(path, sizeof(path), "/proc/%s/comm", entry->d_name);
+    descriptor = open(path, O_RDONLY);
+    if(descriptor < 0)
+    {
+      continue;
+    }
+    length = read(descriptor, comm, sizeof(comm));
+    close(descriptor);
+
+    if(is_target(comm, length))
+    {
+      result->found++;
+      result->pid = atoi(entry->d_name);
+    }
+  }
+  closedir(directory);
+
+  return 0;
+}
+
+/**
+ * Lists the pids in /proc with raw getdents64(), which returns thousands
+ * of entries per call instead of going through readdir() one at a time.
+ */
+static int list_pids(parallel_scanner_t *scanner)
+{
+  static char buffer[DIRENT_BUFFER_LENGTH];
+  long length, offset;
+
+  scanner->number_of_pids = 0;
+  lseek(scanner->proc_descriptor, 0, SEEK_SET);
+
+  while((length = syscall(SYS_getdents64, scanner->proc_descriptor, buffer, sizeof(buffer))) > 0)
+  {
+    for(offset = 0; offset < length; )
+    {
+      struct
+      {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+      } *entry = (void *)(buffer + offset);
+      const char *digit;
+      pid_t pid = 0;
+
+      offset += entry->d_reclen;
+      if(entry->d_name[0] < '1' || entry->d_name[0] > '9')
+      {
+        continue;
+      }
+      for(digit = entry->d_name; *digit; digit++)
+      {
+        pid = pid * 10 + (*digit - '0');
+      }
+
+      if(scanner->number_of_pids == scanner->capacity)
+      {
+        unsigned int capacity = scanner->capacity ? scanner->capacity * 2 : 4096;
+        pid_t *pids = realloc(scanner->pids, capacity * sizeof(pid_t));
+        if(pids == NULL)
+        {
+          return -1;
+        }
+        scanner->pids = pids;
+        scanner->capacity = capacity;
+      }
+      scanner->pids[scanner->number_of_pids++] = pid;
+    }
+  }
+
+  return length < 0 ? -1 : 0;
+}
+
+static void *run_scanner(void *argument)
+{
+  parallel_scanner_t *scanner = argument;
+  char path[32], comm[COMM_LENGTH + 1];
+  unsigned int first, i;
+  ssize_t length;
+  int descriptor;
+
+  for(;;)
+  {
+    pthread_barrier_wait(&scanner->start);
+    if(scanner->stop)
+    {
+      return NULL;
+    }
+
+    while((first = atomic_fetch_add(&scanner->next_pid, PID_CHUNK)) < scanner->number_of_pids)
+    {
+      for(i = first; i < first + PID_CHUNK && i < scanner->number_of_pids; i++)
+      {
+        snprintf(path, sizeof(path), "%d/comm", scanner->pids[i]);
+        descriptor = openat(scanner->proc_descriptor, path, O_RDONLY | O_CLOEXEC);
+        if(descriptor < 0)
+        {
+          continue;
+        }
+        length = read(descriptor, comm, sizeof(comm));
+        close(descriptor);
+
+        if(is_target(comm, length))
+        {
+          atomic_fetch_add(&scanner->found, 1);
+          atomic_store(&scanner->found_pid, scanner->pids[i]);
+        }
+      }
+    }
+
+    pthread_barrier_wait(&scanner->done);
+  }
+}
+
+static int start_scanner(parallel_scanner_t *scanner, int number_of_threads)
+{
+  int i;
+
+  memset(scanner, 0, sizeof(*scanner));
+  scanner->proc_descriptor = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(scanner->proc_descriptor < 0)
+  {
+    return -1;
+  }
+  scanner->number_of_threads = number_of_threads;
+  scanner->threads = calloc(number_of_threads, sizeof(pthread_t));
+  if(scanner->threads == NULL)
+  {
+    return -1;
+  }
+  pthread_barrier_init(&scanner->start, NULL, number_of_threads + 1);
+  pthread_barrier_init(&scanner->done, NULL, number_of_threads + 1);
+  for(i = 0; i < number_of_threads; i++)
+  {
+    if(pthread_create(&scanner->threads[i], NULL, run_scanner, scanner) != 0)
+    {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static void stop_scanner(parallel_scanner_t *scanner)
+{
+  int i;
+
+  scanner->stop = 1;
+  pthread_barrier_wait(&scanner->start);
+  for(i = 0; i < scanner->number_of_threads; i++)
+  {
+    pthread_join(scanner->threads[i], NULL);
+  }
+  pthread_barrier_destroy(&scanner->start);
+  pthread_barrier_destroy(&scanner->done);
+  close(scanner->proc_descriptor);
+  free(scanner->threads);
+  free(scanner->pids);
+}
+
+static int lookup_parallel(parallel_scanner_t *scanner, lookup_result_t *result)
+{
+  if(list_pids(scanner) < 0)
+  {
+    return -1;
+  }
+  atomic_store(&scanner->next_pid, 0);
+  atomic_store(&scanner->found, 0);
+
+  // The workers are already running, the barriers only hand them the list
+  pthread_barrier_wait(&scanner->start);
+  pthread_barrier_wait(&scanner->done);
+
+  result->entries = scanner->number_of_pids;
+  result->found = atomic_load(&scanner->found);
+  result->pid = atomic_load(&scanner->found_pid);
+
+  return 0;
+}
+
+/**
+ * Opens /proc/findtask with query as the pending lookup.
+ * @return the descriptor, or -1 if the module is not loaded
+ */
+static int open_findtask(const char *path, const char *query)
+{
+  int descriptor = open(path, O_RDWR | O_CLOEXEC);
+
+  if(descriptor < 0)
+  {
+    return -1;
+  }
+  if(write(descriptor, query, strlen(query)) < 0)
+  {
+    close(descriptor);
+    return -1;
+  }
+
+  return descriptor;
+}
+
+static int compare_latencies(const void *first, const void *second)
+{
+  uint64_t a = *(const uint64_t *)first, b = *(const uint64_t *)second;
+  return (a > b) - (a < b);
+}
+
+static void print_latencies_json(FILE *output, uint64_t *latencies, int count)
+{
+  uint64_t sum = 0;
+  int i;
+
+  qsort(latencies, count, sizeof(uint64_t), compare_latencies);
+  for(i = 0; i < count; i++)
+  {
+    sum += latencies[i];
+  }
+
+  fprintf(output, "\"latency_us\": { \"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+          "\"max\": %.1f, \"mean\": %.1f }",
+          latencies[0] / 1e3, latencies[count / 2] / 1e3, latencies[count * 9 / 10] / 1e3,
+          latencies[count * 99 / 100] / 1e3, latencies[count - 1] / 1e3, sum / 1e3 / count);
+}
+
+/**
+ * Times configuration->repetitions lookups with one approach and prints
+ * one JSON object for them.
+ */
+static void run_approach(FILE *output, const benchmark_configuration_t *configuration, int approach,
+                         int descriptor, parallel_scanner_t *scanner, uint64_t *latencies, int *first)
+{
+  lookup_result_t result = { 0 };
+  uint64_t start;
+  int repetition, failures = 0, status = 0;
+
+  for(repetition = 0; repetition < configuration->repetitions; repetition++)
+  {
+    memset(&result, 0, sizeof(result));
+
+    start = now_in_ns();
+    switch(approach)
+    {
+      case ApproachFindTaskIndex:
+      case ApproachFindTaskWalk:
+        status = lookup_findtask(descriptor, &result);
+        break;
+      case ApproachNaive:
+        status = lookup_naive(&result);
+        break;
+      case ApproachParallel:
+        status = lookup_parallel(scanner, &result);
+        break;
+    }
+    latencies[repetition] = now_in_ns() - start;
+
+    if(status < 0 || result.found != 1 || result.pid != target)
+    {
+      failures++;
+    }
+  }
+
+  fprintf(output, "%s\n    { \"processes\": %u, \"approach\": \"%s\", \"scanned\": %u, \"wrong_answers\": %d, ",
+          *first ? "" : ",", number_of_dummies + 1, approach_names[approach], result.entries, failures);
+  print_latencies_json(output, latencies, configuration->repetitions);
+  fprintf(output, " }");
+  fflush(output);
+  *first = 0;
+}
+
+/**
+ * Parses an ascending list of process counts such as "1000,10000,100000".
+ */
+static int parse_counts(const char *text, benchmark_configuration_t *configuration)
+{
+  char *copy = strdup(text);
+  char *saveptr = NULL;
+  char *entry;
+
+  configuration->number_of_counts = 0;
+  for(entry = strtok_r(copy, ",", &saveptr); entry != NULL; entry = strtok_r(NULL, ",", &saveptr))
+  {
+    unsigned int count = strtoul(entry, NULL, 10);
+
+    if(configuration->number_of_counts == sizeof(configuration->counts) / sizeof(configuration->counts[0]) ||
+       count == 0 ||
+       (configuration->number_of_counts > 0 && count <= configuration->counts[configuration->number_of_counts - 1]))
+    {
+      free(copy);
+      return -1;
+    }
+    configuration->counts[configuration->number_of_counts++] = count;
+  }
+  free(copy);
+
+  return configuration->number_of_counts > 0 ? 0 : -1;
+}
+
+static void print_usage(const char *program)
+{
+  fprintf(stderr, "[!] Usage: %s [options], JSON report on stdout\n", program);
+  fprintf(stderr, "    -n <counts>     ascending numbers of dummy processes (default 1000,10000,100000)\n");
+  fprintf(stderr, "    -r <lookups>    timed lookups per approach and count (default 50)\n");
+  fprintf(stderr, "    -t <threads>    threads of the parallel scanner (default: online CPUs)\n");
+  fprintf(stderr, "    -f <path>       FindTask query file (default %s)\n", FIND_TASK_PATH);
+}
+
+int main(int argc, char *argv[])
+{
+  benchmark_configuration_t configuration =
+    {
+      .repetitions = 50,
+      .number_of_threads = sysconf(_SC_NPROCESSORS_ONLN),
+      .findtask_path = FIND_TASK_PATH
+    };
+  int descriptors[NumberOfApproaches] = { -1, -1, -1, -1 };
+  struct rlimit limit = { RLIM_INFINITY, RLIM_INFINITY };
+  parallel_scanner_t scanner;
+  uint64_t *latencies;
+  int option, i, approach, first = 1;
+
+  parse_counts("1000,10000,100000", &configuration);
+
+  while((option = getopt(argc, argv, "n:r:t:f:")) != -1)
+  {
+    switch(option)
+    {
+      case 'n':
+        if(parse_counts(optarg, &configuration) < 0)
+        {
+          print_usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'r':
+        configuration.repetitions = atoi(optarg);
+        break;
+      case 't':
+        configuration.number_of_threads = atoi(optarg);
+        break;
+      case 'f':
+        configuration.findtask_path = optarg;
+        break;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+  if(configuration.repetitions <= 0 || configuration.number_of_threads <= 0)
+  {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  // Lift the process limit as far as allowed, pid_max and threads-max still apply
+  if(setrlimit(RLIMIT_NPROC, &limit) < 0 && getrlimit(RLIMIT_NPROC, &limit) == 0)
+  {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NPROC, &limit);
+  }
+
+  dummies = calloc(configuration.counts[configuration.number_of_counts - 1], sizeof(pid_t));
+  latencies = calloc(configuration.repetitions, sizeof(uint64_t));
+  // Stacks are only touched at the top, so the untouched pages cost nothing
+  dummy_stacks = mmap(NULL, ((size_t)configuration.counts[configuration.number_of_counts - 1] + 1) * DUMMY_STACK_SIZE,
+                      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if(dummies == NULL || latencies == NULL || dummy_stacks == MAP_FAILED)
+  {
+    perror("Failed to allocate the dummy processes");
+    return errno;
+  }
+
+  target = start_dummy(TARGET_NAME, dummy_stacks);
+  if(target < 0 || start_scanner(&scanner, configuration.number_of_threads) < 0)
+  {
+    perror("Failed to start the benchmark");
+    stop_dummies();
+    return errno;
+  }
+  wait_for_target();
+
+  descriptors[ApproachFindTaskIndex] = open_findtask(configuration.findtask_path, TARGET_NAME);
+  descriptors[ApproachFindTaskWalk] = open_findtask(configuration.findtask_path, TARGET_GLOB);
+  if(descriptors[ApproachFindTaskIndex] < 0)
+  {
+    fprintf(stderr, "[!] %s is not available, skipping the FindTask approaches\n", configuration.findtask_path);
+  }
+
+  fprintf(stdout, "{\n  \"threads\": %d,\n  \"repetitions\": %d,\n  \"results\": [",
+          configuration.number_of_threads, configuration.repetitions);
+  for(i = 0; i < configuration.number_of_counts; i++)
+  {
+    if(grow_dummies(configuration.counts[i]) < 0)
+    {
+      fprintf(stderr, "[-] ERROR: Could only start %u dummy processes: %s\n", number_of_dummies, strerror(errno));
+      break;
+    }
+
+    for(approach = 0; approach < NumberOfApproaches; approach++)
+    {
+      if((approach == ApproachFindTaskIndex || approach == ApproachFindTaskWalk) && descriptors[approach] < 0)
+      {
+        continue;
+      }
+      run_approach(stdout, &configuration, approach, descriptors[approach], &scanner, latencies, &first);
+    }
+  }
+  fprintf(stdout, "\n  ]\n}\n");
+
+  for(approach = 0; approach < NumberOfApproaches; approach++)
+  {
+    if(descriptors[approach] >= 0)
+    {
+      close(descriptors[approach]);
+    }
+  }
+  stop_scanner(&scanner);
+  stop_dummies();
+  free(latencies);
+  free(dummies);
+
+  return 0;
+}
@@ -0,0 +1,543 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+/**
+ * Matches a string against many glob patterns in one pass over the string.
+ * Shared by the FindTask module and user space, so it can be checked
+ * against fnmatch().
+ *
+ * Patterns match the whole string: '*' matches any run of bytes, '?' any
+ * one byte, [abc], [a-z] and [!a-z] (or [^a-z]) a set of bytes, and '\'
+ * makes the next byte literal, inside brackets as well. A prefix is just
+ * "name*".
+ *
+ * All patterns are compiled into one NFA with one bit per position, laid
+ * out so a step is a shift and two masks over the whole bit set. Matching
+ * turns it into a DFA lazily: every set of positions the input reaches
+ * becomes a DFA state, and its transitions over byte classes (bytes no
+ * pattern tells apart share a column) are filled in the first time they are
+ * taken. Once the strings seen so far are covered, a string costs one table
+ * lookup per byte no matter how many patterns there are. Patterns with a
+ * leading '*' can make the full DFA huge, but only the states real input
+ * reaches are ever built; if those still outgrow the cache it is flushed
+ * and rebuilt from the current state.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+
+#define matcher_zalloc(size) kvzalloc(size, GFP_KERNEL)
+#define matcher_release(pointer) kvfree(pointer)
+#define matcher_lowest_bit(word) __ffs64(word)
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+typedef uint64_t u64;
+typedef uint16_t u16;
+
+#define matcher_zalloc(size) calloc(1, size)
+#define matcher_release(pointer) free(pointer)
+#define matcher_lowest_bit(word) __builtin_ctzll(word)
+#endif
+
+#define MATCHER_MAX_PATTERNS   1024
+#define MATCHER_MAX_BITS       16384   ///< NFA positions over all patterns, one per token plus a start bit each
+#define MATCHER_MAX_DFA_STATES 1024
+#define MATCHER_MIN_DFA_STATES 16
+#define MATCHER_CACHE_SIZE     (512 * 1024)   ///< Bytes the DFA states may take, the state count adapts
+#define MATCHER_DEAD_STATE     0       ///< No pattern can match anymore
+#define MATCHER_START_STATE    1
+#define MATCHER_UNKNOWN_STATE  0xffff  ///< Transition not built yet
+
+#define MATCHER_WORD_BITS 64
+#define MATCHER_WORDS(bits) (((bits) + MATCHER_WORD_BITS - 1) / MATCHER_WORD_BITS)
+
+struct matcher
+{
+  unsigned int number_of_patterns;
+  unsigned int words;                     ///< 64-bit words in an NFA state set
+  unsigned int number_of_classes;
+  unsigned char byte_class[256];          ///< Column of every byte
+
+  // The NFA. Bit k of pattern p means "the first k tokens of p matched".
+  u64 *class_bits;                        ///< [class][word] positions entered by consuming a byte of the class
+  u64 *star_bits;                         ///< [word] positions of '*' tokens, they loop on any byte
+  u64 *start;                             ///< [word] the start bits, closed over leading '*'
+  u64 *accept;                            ///< [word] the last bit of every pattern
+  u16 *bit_pattern;                       ///< [bit] pattern every bit belongs to
+
+  // The DFA cache, one NFA position set per state
+  unsigned int number_of_states;
+  unsigned int max_states;                ///< Fits MATCHER_CACHE_SIZE for this many words and classes
+  unsigned int table_size;                ///< Slots in table, twice max_states
+  u64 *sets;                              ///< [max_states + 1][word], the last one is a work area
+  u16 *transitions;                       ///< [state][class], MATCHER_UNKNOWN_STATE until taken
+  unsigned char *accepting;               ///< [state] nonzero when a pattern ends in the state
+  u16 *table;                             ///< Open addressing index of sets, holds state + 1
+};
+
+typedef void (*matcher_callback_t)(unsigned int pattern, void *private);
+
+/**
+ * A parsed token: either '*' or a set of bytes.
+ */
+struct matcher_token
+{
+  int star;
+  u64 set[4];
+};
+
+/**
+ * Parses the token at pattern and returns how many bytes it used,
+ * or 0 for a '[' without its ']' or a '\' at the end.
+ */
+static inline size_t matcher_parse_token(const char *pattern, struct matcher_token *token)
+{
+  const unsigned char *cursor = (const unsigned char *)pattern;
+  int negate = 0, first = 1;
+  unsigned int byte, low, high;
+
+  memset(token, 0, sizeof(*token));
+
+  switch(*cursor)
+  {
+    case '*':
+      token->star = 1;
+      return 1;
+    case '?':
+      memset(token->set, 0xff, sizeof(token->set));
+      return 1;
+    case '\\':
+      if(cursor[1] == '\0')
+      {
+        return 0;
+      }
+      token->set[cursor[1] / 64] |= 1ULL << (cursor[1] % 64);
+      return 2;
+    case '[':
+      break;
+    default:
+      token->set[*cursor / 64] |= 1ULL << (*cursor % 64);
+      return 1;
+  }
+
+  cursor++;
+  if(*cursor == '!' || *cursor == '^')
+  {
+    negate = 1;
+    cursor++;
+  }
+  // A ']' right after the '[' is a member, not the end
+  while(*cursor != '\0' && (*cursor != ']' || first))
+  {
+    // '\' escapes inside brackets too, so [\]] is the set of one ']'
+    if(*cursor == '\\' && cursor[1] != '\0')
+    {
+      cursor++;
+    }
+    low = high = *cursor++;
+    if(*cursor == '-' && cursor[1] != ']' && cursor[1] != '\0')
+    {
+      if(cursor[1] == '\\' && cursor[2] != '\0')
+      {
+        cursor++;
+      }
+      high = cursor[1];
+      cursor += 2;
+    }
+    for(byte = low; byte <= high; byte++)
+    {
+      token->set[byte / 64] |= 1ULL << (byte % 64);
+    }
+    first = 0;
+  }
+  if(*cursor != ']')
+  {
+    return 0;
+  }
+  if(negate)
+  {
+    for(byte = 0; byte < 4; byte++)
+    {
+      token->set[byte] = ~token->set[byte];
+    }
+  }
+
+  return cursor + 1 - (const unsigned char *)pattern;
+}
+
+static inline int matcher_test_bit(const u64 *set, unsigned int bit)
+{
+  return (set[bit / MATCHER_WORD_BITS] >> (bit % MATCHER_WORD_BITS)) & 1;
+}
+
+static inline void matcher_set_bit(u64 *set, unsigned int bit)
+{
+  set[bit / MATCHER_WORD_BITS] |= 1ULL << (bit % MATCHER_WORD_BITS);
+}
+
+/**
+ * One NFA step: every position moves on over a token that accepts a byte
+ * of class, '*' positions also stay, then positions in front of a '*' are
+ * closed over it. Runs of '*' were merged when compiling, so one closure
+ * round is enough.
+ */
+static inline void matcher_step(const struct matcher *matcher, const u64 *from, u64 *to, unsigned int class)
+{
+  const u64 *class_bits = matcher->class_bits + (size_t)class * matcher->words;
+  u64 carry = 0, next;
+  unsigned int i;
+
+  for(i = 0; i < matcher->words; i++)
+  {
+    to[i] = (((from[i] << 1) | carry) & class_bits[i]) | (from[i] & matcher->star_bits[i]);
+    carry = from[i] >> (MATCHER_WORD_BITS - 1);
+  }
+
+  carry = 0;
+  for(i = 0; i < matcher->words; i++)
+  {
+    next = to[i] >> (MATCHER_WORD_BITS - 1);
+    to[i] |= ((to[i] << 1) | carry) & matcher->star_bits[i];
+    carry = next;
+  }
+}
+
+static inline void matcher_free(struct matcher *matcher)
+{
+  if(!matcher)
+  {
+    return;
+  }
+  matcher_release(matcher->class_bits);
+  matcher_release(matcher->star_bits);
+  matcher_release(matcher->start);
+  matcher_release(matcher->accept);
+  matcher_release(matcher->bit_pattern);
+  matcher_release(matcher->sets);
+  matcher_release(matcher->transitions);
+  matcher_release(matcher->accepting);
+  matcher_release(matcher->table);
+  matcher_release(matcher);
+}
+
+static inline u64 matcher_hash_set(const u64 *set, unsigned int words)
+{
+  u64 hash = 0xcbf29ce484222325ULL;
+  unsigned int i;
+
+  for(i = 0; i < words; i++)
+  {
+    hash = (hash ^ set[i]) * 0x100000001b3ULL;
+    hash ^= hash >> 29;
+  }
+
+  return hash;
+}
+
+static inline u64 *matcher_set(const struct matcher *matcher, unsigned int state)
+{
+  return matcher->sets + (size_t)state * matcher->words;
+}
+
+/**
+ * Returns the state of the position set in the work area, adding it if it
+ * is new, or MATCHER_UNKNOWN_STATE when the cache is full.
+ */
+static inline unsigned int matcher_add_state(struct matcher *matcher)
+{
+  unsigned int words = matcher->words, state = matcher->number_of_states, i;
+  u64 *set = matcher_set(matcher, state);
+  unsigned int slot = matcher_hash_set(set, words) % matcher->table_size;
+
+  while(matcher->table[slot] != 0)
+  {
+    if(memcmp(matcher_set(matcher, matcher->table[slot] - 1), set, sizeof(u64) * words) == 0)
+    {
+      return matcher->table[slot] - 1;
+    }
+    slot = (slot + 1) % matcher->table_size;
+  }
+  if(state == matcher->max_states)
+  {
+    return MATCHER_UNKNOWN_STATE;
+  }
+
+  matcher->table[slot] = state + 1;
+  matcher->accepting[state] = 0;
+  for(i = 0; i < words; i++)
+  {
+    matcher->accepting[state] |= (set[i] & matcher->accept[i]) != 0;
+  }
+  memset(matcher->transitions + (size_t)state * matcher->number_of_classes, 0xff,
+         sizeof(u16) * matcher->number_of_classes);
+  matcher->number_of_states++;
+
+  return state;
+}
+
+/**
+ * Empties the cache down to the dead and the start state.
+ */
+static inline void matcher_reset_states(struct matcher *matcher)
+{
+  unsigned int words = matcher->words;
+
+  matcher->number_of_states = 0;
+  memset(matcher->table, 0, sizeof(u16) * matcher->table_size);
+
+  memset(matcher_set(matcher, 0), 0, sizeof(u64) * words);
+  matcher_add_state(matcher);
+  memcpy(matcher_set(matcher, 1), matcher->start, sizeof(u64) * words);
+  matcher_add_state(matcher);
+}
+
+/**
+ * Follows a transition that is not in the cache yet.
+ */
+static inline unsigned int matcher_build_transition(struct matcher *matcher, unsigned int state, unsigned int class)
+{
+  unsigned int words = matcher->words, next;
+
+  // The slot past the last state is the work area for the new set
+  matcher_step(matcher, matcher_set(matcher, state), matcher_set(matcher, matcher->number_of_states), class);
+  next = matcher_add_state(matcher);
+  if(next != MATCHER_UNKNOWN_STATE)
+  {
+    matcher->transitions[(size_t)state * matcher->number_of_classes + class] = next;
+    return next;
+  }
+
+  // Full, so the new set is in the work area past the last state: start
+  // over from the dead state, the start and that set
+  matcher_reset_states(matcher);
+  memcpy(matcher_set(matcher, matcher->number_of_states), matcher_set(matcher, matcher->max_states),
+         sizeof(u64) * words);
+
+  return matcher_add_state(matcher);
+}
+
+/**
+ * Compiles count patterns into *result. Pattern i is reported as i.
+ * @return 0, -EINVAL for a bad or too large pattern set, or -ENOMEM
+ */
+static inline int matcher_compile(const char *const *patterns, unsigned int count, struct matcher **result)
+{
+  struct matcher_token token;
+  struct matcher *matcher;
+  u16 (*split)[2];
+  unsigned int bits = 0, bit, pattern, byte, class, number_of_classes;
+  const char *cursor;
+  size_t used;
+  int previous_star;
+
+  if(count == 0 || count > MATCHER_MAX_PATTERNS)
+  {
+    return -EINVAL;
+  }
+
+  // First pass: check the patterns and count the positions
+  for(pattern = 0; pattern < count; pattern++)
+  {
+    bits++;
+    previous_star = 0;
+    for(cursor = patterns[pattern]; *cursor != '\0'; cursor += used)
+    {
+      used = matcher_parse_token(cursor, &token);
+      if(used == 0)
+      {
+        return -EINVAL;
+      }
+      if(!(token.star && previous_star))
+      {
+        bits++;
+      }
+      previous_star = token.star;
+    }
+  }
+  if(bits > MATCHER_MAX_BITS)
+  {
+    return -EINVAL;
+  }
+
+  matcher = matcher_zalloc(sizeof(*matcher));
+  if(!matcher)
+  {
+    return -ENOMEM;
+  }
+  matcher->number_of_patterns = count;
+  matcher->words = MATCHER_WORDS(bits);
+  matcher->star_bits = matcher_zalloc(sizeof(u64) * matcher->words);
+  matcher->start = matcher_zalloc(sizeof(u64) * matcher->words);
+  matcher->accept = matcher_zalloc(sizeof(u64) * matcher->words);
+  matcher->bit_pattern = matcher_zalloc(sizeof(u16) * matcher->words * MATCHER_WORD_BITS);
+  // At most 256 classes; sized for that and filled once the classes are known
+  matcher->class_bits = matcher_zalloc(sizeof(u64) * matcher->words * 256);
+  if(!matcher->star_bits || !matcher->start || !matcher->accept || !matcher->bit_pattern ||
+     !matcher->class_bits)
+  {
+    matcher_free(matcher);
+    return -ENOMEM;
+  }
+
+  // Second pass: split the bytes into classes, token by token. split maps
+  // (old class, member of the token) to the new class + 1; it is 1 KiB, too
+  // much for a kernel stack
+  split = matcher_zalloc(sizeof(*split) * 256);
+  if(!split)
+  {
+    matcher_free(matcher);
+    return -ENOMEM;
+  }
+  number_of_classes = 1;
+  for(pattern = 0; pattern < count; pattern++)
+  {
+    for(cursor = patterns[pattern]; *cursor != '\0'; cursor += used)
+    {
+      used = matcher_parse_token(cursor, &token);
+      if(token.star)
+      {
+        continue;
+      }
+      memset(split, 0, sizeof(*split) * 256);
+      class = 0;
+      for(byte = 0; byte < 256; byte++)
+      {
+        int member = matcher_test_bit(token.set, byte);
+        u16 *target = &split[matcher->byte_class[byte]][member];
+
+        if(*target == 0)
+        {
+          *target = ++class;
+        }
+        matcher->byte_class[byte] = *target - 1;
+      }
+      number_of_classes = class;
+    }
+  }
+  matcher_release(split);
+  matcher->number_of_classes = number_of_classes;
+
+  // Third pass: lay out the positions
+  bit = 0;
+  for(pattern = 0; pattern < count; pattern++)
+  {
+    matcher_set_bit(matcher->start, bit);
+    matcher->bit_pattern[bit] = pattern;
+    previous_star = 0;
+    for(cursor = patterns[pattern]; *cursor != '\0'; cursor += used)
+    {
+      used = matcher_parse_token(cursor, &token);
+      if(token.star && previous_star)
+      {
+        continue;
+      }
+      previous_star = token.star;
+      bit++;
+      matcher->bit_pattern[bit] = pattern;
+      if(token.star)
+      {
+        matcher_set_bit(matcher->star_bits, bit);
+        continue;
+      }
+      for(byte = 0; byte < 256; byte++)
+      {
+        if(matcher_test_bit(token.set, byte))
+        {
+          matcher_set_bit(matcher->class_bits + (size_t)matcher->byte_class[byte] * matcher->words, bit);
+        }
+      }
+    }
+    matcher_set_bit(matcher->accept, bit);
+    bit++;
+  }
+
+  // Close the start over patterns that begin with '*'
+  for(bit = 0; bit + 1 < matcher->words * MATCHER_WORD_BITS; bit++)
+  {
+    if(matcher_test_bit(matcher->start, bit) && matcher_test_bit(matcher->star_bits, bit + 1))
+    {
+      matcher_set_bit(matcher->start, bit + 1);
+    }
+  }
+
+  // Size the DFA cache; a set needs words * 8 bytes, its transitions 2 bytes per class
+  matcher->max_states = MATCHER_CACHE_SIZE /
+                        (sizeof(u64) * matcher->words + sizeof(u16) * number_of_classes + 1);
+  if(matcher->max_states > MATCHER_MAX_DFA_STATES)
+  {
+    matcher->max_states = MATCHER_MAX_DFA_STATES;
+  }
+  if(matcher->max_states < MATCHER_MIN_DFA_STATES)
+  {
+    matcher->max_states = MATCHER_MIN_DFA_STATES;
+  }
+  matcher->table_size = 2 * matcher->max_states;
+  matcher->sets = matcher_zalloc(sizeof(u64) * matcher->words * (matcher->max_states + 1));
+  matcher->transitions = matcher_zalloc(sizeof(u16) * number_of_classes * matcher->max_states);
+  matcher->accepting = matcher_zalloc(matcher->max_states);
+  matcher->table = matcher_zalloc(sizeof(u16) * matcher->table_size);
+  if(!matcher->sets || !matcher->transitions || !matcher->accepting || !matcher->table)
+  {
+    matcher_free(matcher);
+    return -ENOMEM;
+  }
+  matcher_reset_states(matcher);
+
+  *result = matcher;
+  return 0;
+}
+
+/**
+ * Runs text through the matcher and calls callback once for every pattern
+ * that matches all of it. Builds DFA states as it goes, so one matcher must
+ * not be used by two threads at once.
+ * @return the number of patterns that matched
+ */
+static inline unsigned int matcher_match(struct matcher *matcher, const char *text, size_t size,
+                                         matcher_callback_t callback, void *private)
+{
+  const unsigned char *bytes = (const unsigned char *)text;
+  unsigned int state = MATCHER_START_STATE, next, class, matches = 0, i;
+  const u64 *set;
+  u64 word;
+  size_t position;
+
+  for(position = 0; position < size && state != MATCHER_DEAD_STATE; position++)
+  {
+    class = matcher->byte_class[bytes[position]];
+    next = matcher->transitions[(size_t)state * matcher->number_of_classes + class];
+    if(next == MATCHER_UNKNOWN_STATE)
+    {
+      next = matcher_build_transition(matcher, state, class);
+    }
+    state = next;
+  }
+
+  if(!matcher->accepting[state])
+  {
+    return 0;
+  }
+
+  set = matcher_set(matcher, state);
+  for(i = 0; i < matcher->words; i++)
+  {
+    for(word = set[i] & matcher->accept[i]; word != 0; word &= word - 1)
+    {
+      callback(matcher->bit_pattern[i * MATCHER_WORD_BITS + matcher_lowest_bit(word)], private);
+      matches++;
+    }
+  }
+
+  return matches;
+}
+
+#endif
@@ -0,0 +1,207 @@
+/**
+ * Checks matcher.h against the known answers in matcher_vectors.h and
+ * against fnmatch(): every pattern on its own, all of the table patterns in
+ * one matcher, and random pattern sets over a small alphabet on random
+ * strings. The random sets have enough leading '*' patterns to outgrow the
+ * DFA cache, so the flush path is checked as well.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include "matcher.h"
+#include "matcher_vectors.h"
+
+#define RANDOM_ROUNDS 50
+#define RANDOM_PATTERNS 300           ///< Patterns in every random set
+#define RANDOM_TEXTS 2000             ///< Strings every random set is matched against
+#define RANDOM_PATTERN_TOKENS 8
+#define RANDOM_TEXT_LENGTH 24
+
+/// Marks every pattern the matcher reports
+static void mark_match(unsigned int pattern, void *private)
+{
+  unsigned char *matched = private;
+
+  matched[pattern]++;
+}
+
+/**
+ * Matches text with a matcher of count patterns and compares every pattern
+ * with fnmatch().
+ */
+static int check_text(struct matcher *matcher, const char *const *patterns, unsigned int count, const char *text)
+{
+  unsigned char matched[MATCHER_MAX_PATTERNS];
+  unsigned int i, matches, expected_matches = 0;
+  int failures = 0;
+
+  memset(matched, 0, count);
+  matches = matcher_match(matcher, text, strlen(text), mark_match, matched);
+
+  for(i = 0; i < count; i++)
+  {
+    int expected = fnmatch(patterns[i], text, 0) == 0;
+
+    expected_matches += expected;
+    if(matched[i] != expected)
+    {
+      fprintf(stderr, "[-] ERROR: Pattern [%s] on [%s] gave %d, fnmatch() %d\n", patterns[i], text,
+              matched[i], expected);
+      failures++;
+    }
+  }
+  if(matches != expected_matches)
+  {
+    fprintf(stderr, "[-] ERROR: [%s] reported %u matches, fnmatch() found %u\n", text, matches, expected_matches);
+    failures++;
+  }
+
+  return failures;
+}
+
+/**
+ * Checks every vector on its own, then all the valid patterns in one matcher
+ * on every text of the table.
+ */
+static int check_vectors(void)
+{
+  const char *patterns[NUMBER_OF_MATCHER_VECTORS];
+  struct matcher *matcher;
+  unsigned char matched;
+  unsigned int count = 0;
+  size_t i;
+  int failures = 0, error_number;
+
+  for(i = 0; i < NUMBER_OF_MATCHER_VECTORS; i++)
+  {
+    const matcher_vector_t *vector = &matcher_vectors[i];
+
+    error_number = matcher_compile(&vector->pattern, 1, &matcher);
+    if(vector->match < 0)
+    {
+      if(error_number != -EINVAL)
+      {
+        fprintf(stderr, "[-] ERROR: Pattern [%s] should have been rejected\n", vector->pattern);
+        failures++;
+      }
+      if(error_number == 0)
+      {
+        matcher_free(matcher);
+      }
+      continue;
+    }
+    if(error_number != 0)
+    {
+      fprintf(stderr, "[-] ERROR: Pattern [%s] did not compile: %s\n", vector->pattern, strerror(-error_number));
+      failures++;
+      continue;
+    }
+
+    matched = 0;
+    matcher_match(matcher, vector->text, strlen(vector->text), mark_match, &matched);
+    if(matched != vector->match)
+    {
+      fprintf(stderr, "[-] ERROR: Pattern [%s] on [%s] gave %d instead of %d\n", vector->pattern, vector->text,
+              matched, vector->match);
+      failures++;
+    }
+    if((fnmatch(vector->pattern, vector->text, 0) == 0) != vector->match)
+    {
+      fprintf(stderr, "[-] ERROR: fnmatch() disagrees with the table on [%s] and [%s]\n", vector->pattern,
+              vector->text);
+      failures++;
+    }
+    matcher_free(matcher);
+
+    patterns[count++] = vector->pattern;
+  }
+
+  error_number = matcher_compile(patterns, count, &matcher);
+  if(error_number != 0)
+  {
+    fprintf(stderr, "[-] ERROR: The table patterns did not compile together: %s\n", strerror(-error_number));
+    return failures + 1;
+  }
+  for(i = 0; i < NUMBER_OF_MATCHER_VECTORS; i++)
+  {
+    failures += check_text(matcher, patterns, count, matcher_vectors[i].text);
+  }
+  matcher_free(matcher);
+
+  return failures;
+}
+
+static void random_pattern(char *pattern)
+{
+  static const char *const tokens[] = { "a", "b", "c", "-", "?", "*", "*", "[ab]", "[!a]", "[a-c]", "\\*", "*" };
+  unsigned int i, length = rand() % (RANDOM_PATTERN_TOKENS + 1);
+
+  pattern[0] = '\0';
+  for(i = 0; i < length; i++)
+  {
+    strcat(pattern, tokens[rand() % (sizeof(tokens) / sizeof(tokens[0]))]);
+  }
+}
+
+static void random_text(char *text)
+{
+  static const char alphabet[] = "abc-*d";
+  unsigned int i, length = rand() % (RANDOM_TEXT_LENGTH + 1);
+
+  for(i = 0; i < length; i++)
+  {
+    text[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+  }
+  text[length] = '\0';
+}
+
+static int check_random(void)
+{
+  static char storage[RANDOM_PATTERNS][RANDOM_PATTERN_TOKENS * 5 + 1];
+  const char *patterns[RANDOM_PATTERNS];
+  char text[RANDOM_TEXT_LENGTH + 1];
+  struct matcher *matcher;
+  unsigned int round, i;
+  int failures = 0, error_number;
+
+  srand(1);
+  for(round = 0; round < RANDOM_ROUNDS && failures == 0; round++)
+  {
+    for(i = 0; i < RANDOM_PATTERNS; i++)
+    {
+      random_pattern(storage[i]);
+      patterns[i] = storage[i];
+    }
+
+    error_number = matcher_compile(patterns, RANDOM_PATTERNS, &matcher);
+    if(error_number != 0)
+    {
+      fprintf(stderr, "[-] ERROR: Random patterns did not compile: %s\n", strerror(-error_number));
+      return failures + 1;
+    }
+    for(i = 0; i < RANDOM_TEXTS; i++)
+    {
+      random_text(text);
+      failures += check_text(matcher, patterns, RANDOM_PATTERNS, text);
+    }
+    matcher_free(matcher);
+  }
+
+  return failures;
+}
+
+int main(void)
+{
+  int failures = check_vectors() + check_random();
+
+  if(failures > 0)
+  {
+    fprintf(stderr, "[-] ERROR: %d matcher checks failed\n", failures);
+    return 1;
+  }
+  printf("[+] matcher.h agrees with fnmatch() on the %zu test vectors and %d random pattern sets\n",
+         NUMBER_OF_MATCHER_VECTORS, RANDOM_ROUNDS);
+
+  return 0;
+}
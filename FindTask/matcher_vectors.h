@@ -0,0 +1,87 @@
+#ifndef MATCHER_VECTORS_H
+#define MATCHER_VECTORS_H
+
+/**
+ * Known answers for matcher.h. matcher_test checks every pattern on its own
+ * and all of them compiled together, and checks fnmatch() gives the same
+ * answers. The table covers the cases the tokenizer treats specially: runs
+ * of '*', ']' as the first member of a set, '\' inside and outside brackets,
+ * ranges that end in an escaped byte, '-' at the end of a set and 15 byte
+ * comms like the kernel cuts names to. match is -1 for patterns
+ * matcher_compile() rejects; fnmatch() takes those literally instead.
+ */
+typedef struct matcher_vector_t
+{
+  const char *pattern;
+  const char *text;
+  int match;
+} matcher_vector_t;
+
+static const matcher_vector_t matcher_vectors[] =
+{
+  { "",                   "",                  1 },
+  { "",                   "a",                 0 },
+  { "a",                  "a",                 1 },
+  { "a",                  "",                  0 },
+  { "a",                  "ab",                0 },
+  { "nginx",              "nginx",             1 },
+  { "nginx",              "nginx:",            0 },
+  { "nginx*",             "nginx",             1 },
+  { "nginx*",             "nginx: worker",     1 },
+  { "nginx*",             "ngin",              0 },
+  { "*",                  "",                  1 },
+  { "*",                  "anything at all",   1 },
+  { "**",                 "",                  1 },
+  { "a**b",               "ab",                1 },
+  { "a***b",              "axxxb",             1 },
+  { "*d",                 "kworker/0:1H-kblockd", 1 },
+  { "*d",                 "sshd:",             0 },
+  { "*sh*",               "bash",              1 },
+  { "*sh*",               "zsh",               1 },
+  { "*sh*",               "python3",           0 },
+  { "*a*a*a*",            "banana",            1 },
+  { "*a*a*a*a*",          "banana",            0 },
+  { "?",                  "x",                 1 },
+  { "?",                  "",                  0 },
+  { "??",                 "x",                 0 },
+  { "k?orker",            "kworker",           1 },
+  { "systemd-*",          "systemd-journal",   1 },
+  { "systemd-*",          "systemd",           0 },
+  { "[abc]",              "b",                 1 },
+  { "[abc]",              "d",                 0 },
+  { "[a-z]*",             "cron",              1 },
+  { "[a-z]*",             "Xorg",              0 },
+  { "[!a-z]*",            "Xorg",              1 },
+  { "[^a-z]*",            "Xorg",              1 },
+  { "[!a-z]*",            "cron",              0 },
+  { "[]]",                "]",                 1 },
+  { "[]a]",               "a",                 1 },
+  { "[!]]",               "]",                 0 },
+  { "[!]]",               "x",                 1 },
+  { "[a-]",               "-",                 1 },
+  { "[a-]",               "b",                 0 },
+  { "[\\]]",              "]",                 1 },
+  { "[\\!a]",             "!",                 1 },
+  { "[a-\\z]",            "m",                 1 },
+  { "[0-9][0-9]",         "42",                1 },
+  { "[0-9][0-9]",         "4x",                0 },
+  { "\\*",                "*",                 1 },
+  { "\\*",                "a",                 0 },
+  { "\\?x",               "?x",                1 },
+  { "\\[a]",              "[a]",               1 },
+  { "a\\\\b",             "a\\b",              1 },
+  { "kworker/*:*",        "kworker/3:0-events", 1 },
+  { "kworker/*:*",        "kworker/u16",       0 },
+  { "gnome-shell-cal*",   "gnome-shell-cal",   1 },
+  { "???????????????",    "gnome-shell-cal",   1 },
+  { "???????????????",    "gnome-shell-ca",    0 },
+  { "*-*-*",              "a-b-c",             1 },
+  { "*-*-*",              "a-b",               0 },
+  { "[",                  "[",                 -1 },
+  { "[abc",               "a",                 -1 },
+  { "abc\\",              "abc\\",             -1 },
+};
+
+#define NUMBER_OF_MATCHER_VECTORS (sizeof(matcher_vectors) / sizeof(matcher_vectors[0]))
+
+#endif
@@ -4,63 +4,332 @@
 #include <linux/sched.h>
 #include <linux/string.h>
 #include <linux/sched/signal.h>   //Includes for_each_process()
-#include <linux/timer.h>
+#include <linux/workqueue.h>
+#include <linux/hashtable.h>
+#include <linux/stringhash.h>
+#include <linux/spinlock.h>
+#include <linux/tracepoint.h>
+#include <linux/binfmts.h>
+
+#define FIND_TASK_MAX_NAMES 64   ///< Most names the names parameter takes
+#define FIND_TASK_HASH_BITS 7
+#define FIND_TASK_SCAN_BATCH 256 ///< Processes checked between two chances to reschedule
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Javier Vega");
 MODULE_DESCRIPTION("Finds the pid of a process given its name.");
 MODULE_VERSION("1.00");
 
-static char *name = "none";
+static char *name;
 module_param(name, charp, S_IRUGO);
 MODULE_PARM_DESC(name, "The name of the process to find");  
 
-static struct timer_list timer;
+static char *names[FIND_TASK_MAX_NAMES];
+static int number_of_names;
+module_param_array(names, charp, &number_of_names, S_IRUGO);
+MODULE_PARM_DESC(names, "Comma separated names of more processes to find");
+
+static unsigned int poll_interval_ms = 1000;
+module_param(poll_interval_ms, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(poll_interval_ms, "Milliseconds between scans after a scan that found something");
+
+static unsigned int max_poll_interval_ms = 60000;
+module_param(max_poll_interval_ms, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(max_poll_interval_ms, "Longest wait between scans, reached by doubling the wait after every idle scan");
 
 /**
- * find_task_callback - Looks for the given task name once the timer expires.
- * This function needs an argument of type struct timer_list because of the
- * new timer_setup function pointer.
- * @the_timer: this argument is needed for timer_setup
+ * Every wanted name, in a hash set so each task is checked against all of
+ * them with one lookup. The set itself never changes after init; found is
+ * set by the scan and the tracepoint probes under wanted_lock.
  */
-static void find_task_callback(struct timer_list *the_timer)
+struct find_task_name
+{
+  struct hlist_node node;
+  const char *name;
+  unsigned int matches;   ///< Processes found by the scan
+  bool found;             ///< Reported already, not looked for anymore
+};
+
+static DEFINE_HASHTABLE(wanted_names, FIND_TASK_HASH_BITS);
+static struct find_task_name wanted[FIND_TASK_MAX_NAMES + 1];
+static int number_of_wanted;
+static DEFINE_SPINLOCK(wanted_lock);
+
+static struct delayed_work scan_work;
+static unsigned long scan_interval;   ///< Jiffies until the next scan, grows while nothing is found
+
+/// Set when the exec and rename probes are attached, only the first scan is done then
+static bool probes_attached;
+
+static u32 hash_comm(const char *comm)
+{
+  return full_name_hash(NULL, comm, strnlen(comm, TASK_COMM_LEN));
+}
+
+static struct find_task_name *find_wanted(const char *comm)
+{
+  struct find_task_name *entry;
+
+  hash_for_each_possible(wanted_names, entry, node, hash_comm(comm)) {
+    if(!strcmp(comm, entry->name))
+      return entry;
+  }
+
+  return NULL;
+}
+
+static void add_wanted(const char *wanted_name)
+{
+  struct find_task_name *entry = &wanted[number_of_wanted];
+
+  if(find_wanted(wanted_name))
+    return;
+
+  entry->name = wanted_name;
+  entry->matches = 0;
+  entry->found = false;
+  hash_add(wanted_names, &entry->node, hash_comm(wanted_name));
+  number_of_wanted++;
+}
+
+static void check_task(struct task_struct *task)
 {
-  struct task_struct *current_task;
-  int found = 0;
-  pid_t pid = 0; 
+  struct find_task_name *entry = find_wanted(task->comm);
+
+  if(!entry)
+    return;
 
-  // Traverses the list of tasks until we find the process we are looking for.
-  for_each_process(current_task) {
-    if(!strcmp(name, current_task->comm))
+  spin_lock(&wanted_lock);
+  if(!entry->found)
+  {
+    printk("Found process %s with pid %d\n", entry->name, task->pid);
+    entry->matches++;
+  }
+  spin_unlock(&wanted_lock);
+}
+
+/**
+ * Walks the process list like for_each_process(), but leaves the RCU read
+ * side every FIND_TASK_SCAN_BATCH processes when something else wants the
+ * CPU, so a long list does not hold it for the whole walk.
+ * @return false if the process the walk stopped at exited meanwhile and the
+ * rest of the list could not be reached
+ */
+static bool scan_tasks(void)
+{
+  struct task_struct *current_task = &init_task;
+  unsigned int batch = 0;
+  bool alive;
+
+  rcu_read_lock();
+  while((current_task = next_task(current_task)) != &init_task) {
+    check_task(current_task);
+
+    if(++batch < FIND_TASK_SCAN_BATCH || !need_resched())
+      continue;
+    batch = 0;
+
+    get_task_struct(current_task);
+    rcu_read_unlock();
+    cond_resched();
+    rcu_read_lock();
+
+    // Still hashed means still on the list, which keeps its own reference
+    alive = pid_alive(current_task);
+    if(!alive)
     {
-      pid = current_task->pid;
-      found = 1;
+      rcu_read_unlock();
+      put_task_struct(current_task);
+      return false;
     }
+    put_task_struct(current_task);
   }
+  rcu_read_unlock();
+
+  return true;
+}
 
-  if(found)
+/**
+ * find_task_work - Looks for the given task names when the delayed work runs.
+ * All the names are resolved in one traversal, and every process with a
+ * wanted name is reported. Names that were found in a complete walk stop
+ * being looked for.
+ * While some are missing and there are no probes, the next scan is queued
+ * poll_interval_ms later if this one found something and twice as late as
+ * before otherwise, up to max_poll_interval_ms.
+ * @work: the scan_work item
+ */
+static void find_task_work(struct work_struct *work)
+{
+  unsigned long shortest, longest;
+  bool complete = scan_tasks();
+  int i, missing = 0, newly_found = 0;
+
+  // Start over right away. A cut short walk settles no name, or the processes
+  // with it past the point it stopped would never be reported.
+  if(!complete)
   {
-    printk("Found process %s with pid %d\n", name, pid);
+    schedule_delayed_work(&scan_work, 0);
+    return;
+  }
+
+  spin_lock(&wanted_lock);
+  for(i = 0; i < number_of_wanted; i++) {
+    if(wanted[i].found)
+      continue;
+
+    if(wanted[i].matches > 0)
+    {
+      wanted[i].found = true;
+      newly_found++;
+    }
+    else
+    {
+      printk("Not Found process %s\n", wanted[i].name);
+      missing++;
+    }
   }
+  spin_unlock(&wanted_lock);
+
+  // With the probes attached every later exec or rename is seen as it happens
+  if(!missing || probes_attached)
+    return;
+
+  shortest = max(msecs_to_jiffies(READ_ONCE(poll_interval_ms)), 1UL);
+  longest = max(msecs_to_jiffies(READ_ONCE(max_poll_interval_ms)), shortest);
+  if(newly_found)
+    scan_interval = shortest;
   else
+    scan_interval = clamp(scan_interval * 2, shortest, longest);
+
+  schedule_delayed_work(&scan_work, scan_interval);
+}
+
+/**
+ * Reports a process that just got a wanted name, unless the name was
+ * found already. Called from the tracepoint probes, so it must not sleep.
+ */
+static void found_by_event(const char *comm, pid_t pid)
+{
+  struct find_task_name *entry = find_wanted(comm);
+  bool report = false;
+
+  if(!entry)
+    return;
+
+  spin_lock(&wanted_lock);
+  if(!entry->found)
   {
-    printk("Not Found process %s\n", name);
+    entry->found = true;
+    report = true;
+  }
+  spin_unlock(&wanted_lock);
+
+  if(report)
+    printk("Found process %s with pid %d\n", entry->name, pid);
+}
+
+static void probe_process_exec(void *data, struct task_struct *task, pid_t old_pid, struct linux_binprm *bprm)
+{
+  found_by_event(task->comm, task->tgid);
+}
+
+static void probe_task_rename(void *data, struct task_struct *task, const char *comm)
+{
+  // Fires before task->comm changes; only processes count, like for_each_process()
+  if(thread_group_leader(task))
+    found_by_event(comm, task->pid);
+}
+
+/**
+ * The scheduler tracepoints are not exported to modules, so they are looked
+ * up by name with for_each_kernel_tracepoint().
+ */
+struct find_task_probe
+{
+  const char *name;
+  void *probe;
+  struct tracepoint *tracepoint;
+};
+
+static struct find_task_probe find_task_probes[] = {
+  { "sched_process_exec", probe_process_exec },
+  { "task_rename", probe_task_rename }
+};
 
-    // We need to setup the timer again
-    timer.expires += HZ; // add another delay period
-    add_timer(&timer);
+static void match_tracepoint(struct tracepoint *tracepoint, void *private)
+{
+  int i;
+
+  for(i = 0; i < ARRAY_SIZE(find_task_probes); i++) {
+    if(!strcmp(tracepoint->name, find_task_probes[i].name))
+      find_task_probes[i].tracepoint = tracepoint;
+  }
+}
+
+static void unregister_probes(void)
+{
+  int i;
+
+  for(i = 0; i < ARRAY_SIZE(find_task_probes); i++) {
+    if(find_task_probes[i].tracepoint)
+      tracepoint_probe_unregister(find_task_probes[i].tracepoint, find_task_probes[i].probe, NULL);
+    find_task_probes[i].tracepoint = NULL;
   }
+
+  // No probe may still be running once this returns
+  tracepoint_synchronize_unregister();
+}
+
+/**
+ * Attaches the probes. Either all of them are attached or none is, and
+ * then the module falls back to scanning every poll_interval_ms, backing
+ * off up to max_poll_interval_ms while nothing new is found.
+ */
+static bool register_probes(void)
+{
+  int i;
+
+  for_each_kernel_tracepoint(match_tracepoint, NULL);
+
+  for(i = 0; i < ARRAY_SIZE(find_task_probes); i++) {
+    if(!find_task_probes[i].tracepoint ||
+       tracepoint_probe_register(find_task_probes[i].tracepoint, find_task_probes[i].probe, NULL) < 0)
+    {
+      printk(KERN_INFO "FindTaskTimer: Could not attach to %s, polling every %ums (backing off up to %ums) instead\n",
+             find_task_probes[i].name, poll_interval_ms, max_poll_interval_ms);
+      // Only detach the probes that were attached
+      for(; i < ARRAY_SIZE(find_task_probes); i++)
+        find_task_probes[i].tracepoint = NULL;
+      unregister_probes();
+      return false;
+    }
+  }
+
+  return true;
 }
 
 static int __init find_task_init(void) {
-  // Set th timer to expire in one second
-  timer.expires = jiffies + HZ;
+  int i;
 
-  // Sets up a one shot timer
-  timer_setup(&timer, &find_task_callback, 0);
+  // name is only looked for when it was given
+  if(name)
+    add_wanted(name);
+  for(i = 0; i < number_of_names; i++)
+    add_wanted(names[i]);
+  if(number_of_wanted == 0)
+  {
+    printk(KERN_ALERT "FindTaskTimer: Nothing to find, set name= or names=\n");
+    return -EINVAL;
+  }
 
-  // Registers the timer
-  add_timer(&timer);
+  // Attached before the first scan, so a process started in between is not missed
+  probes_attached = register_probes();
+
+  // The first scan runs poll_interval_ms after loading, in process context
+  scan_interval = max(msecs_to_jiffies(poll_interval_ms), 1UL);
+  INIT_DELAYED_WORK(&scan_work, find_task_work);
+  schedule_delayed_work(&scan_work, scan_interval);
 
   printk(KERN_INFO "FindTaskTimer Initialized\n");
 
@@ -68,8 +337,11 @@ static int __init find_task_init(void) {
 }
 
 static void __exit find_task_exit(void) {
-  // Delete the registered timer to give resources back to kernel
-  del_timer(&timer);
+  if(probes_attached)
+    unregister_probes();
+
+  // Also waits for a running scan and stops it from queueing itself again
+  cancel_delayed_work_sync(&scan_work);
 
   printk(KERN_INFO "FindTaskTimer module removed\n");
 }
@@ -0,0 +1,600 @@
+/**
+ * User space companion of FindTaskTimer. Instead of walking the process list
+ * it listens to the proc connector, which reports every fork, exec, rename
+ * and exit as it happens, and follows every process with a wanted name with
+ * a pidfd in the same epoll set, so its exit is noticed without polling.
+ *
+ * For every event the time between the kernel stamping it and the watcher
+ * handling it is reported, and a summary is printed on exit. Listening to
+ * the proc connector needs CAP_NET_ADMIN, so this runs as root.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+#define COMM_LENGTH 16                  ///< TASK_COMM_LEN of the kernel
+#define WATCH_HASH_SIZE 1024            ///< Buckets of the table of followed processes
+#define MAX_EVENTS 64                   ///< Epoll events handled per wakeup
+#define RECEIVE_BUFFER_LENGTH 8192
+
+/**
+ * A process with a wanted name, followed until it exits.
+ */
+typedef struct watched_process_t
+{
+  struct watched_process_t *next;       ///< Next in the same hash bucket
+  pid_t pid;
+  int pidfd;                            ///< -1 once it has woken the watcher
+  char comm[COMM_LENGTH];
+  uint64_t exit_event_ns;               ///< Timestamp of its exit event, 0 until it is seen
+} watched_process_t;
+
+/**
+ * Latency samples of one kind of event, kept so percentiles can be
+ * reported at the end.
+ */
+typedef struct latency_samples_t
+{
+  uint64_t *values;
+  size_t count;
+  size_t capacity;
+} latency_samples_t;
+
+static char **wanted_names;
+static int number_of_wanted;
+
+static watched_process_t *watched[WATCH_HASH_SIZE];
+
+static latency_samples_t detection_latencies;   ///< Fork, exec or rename event until the process is followed
+static latency_samples_t exit_latencies;        ///< Exit event until the watcher has both it and the pidfd wakeup
+
+static volatile sig_atomic_t stop_requested;
+
+static uint64_t now_in_ns(void)
+{
+  struct timespec now;
+  // Same clock as the ktime_get_ns() timestamps of the proc connector
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void handle_signal(int signal_number)
+{
+  (void)signal_number;
+  stop_requested = 1;
+}
+
+static void record_sample(latency_samples_t *samples, uint64_t value)
+{
+  if(samples->count == samples->capacity)
+  {
+    size_t capacity = samples->capacity ? samples->capacity * 2 : 256;
+    uint64_t *values = realloc(samples->values, capacity * sizeof(uint64_t));
+    if(values == NULL)
+    {
+      return;
+    }
+    samples->values = values;
+    samples->capacity = capacity;
+  }
+  samples->values[samples->count++] = value;
+}
+
+static int compare_samples(const void *first, const void *second)
+{
+  uint64_t a = *(const uint64_t *)first, b = *(const uint64_t *)second;
+  return (a > b) - (a < b);
+}
+
+static void print_samples(const char *label, latency_samples_t *samples)
+{
+  if(samples->count == 0)
+  {
+    printf("%s: no samples\n", label);
+    return;
+  }
+
+  qsort(samples->values, samples->count, sizeof(uint64_t), compare_samples);
+  printf("%s: %zu samples, p50 %.1f us, p99 %.1f us, max %.1f us\n", label, samples->count,
+         samples->values[samples->count / 2] / 1e3,
+         samples->values[samples->count * 99 / 100] / 1e3,
+         samples->values[samples->count - 1] / 1e3);
+}
+
+static int is_wanted(const char *comm)
+{
+  int i;
+
+  for(i = 0; i < number_of_wanted; i++)
+  {
+    if(!strncmp(comm, wanted_names[i], COMM_LENGTH - 1))
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static watched_process_t *find_watched(pid_t pid)
+{
+  watched_process_t *process;
+
+  for(process = watched[pid % WATCH_HASH_SIZE]; process != NULL; process = process->next)
+  {
+    if(process->pid == pid)
+    {
+      return process;
+    }
+  }
+
+  return NULL;
+}
+
+static void forget_watched(watched_process_t *process)
+{
+  watched_process_t **link = &watched[process->pid % WATCH_HASH_SIZE];
+
+  while(*link != process)
+  {
+    link = &(*link)->next;
+  }
+  *link = process->next;
+
+  if(process->pidfd >= 0)
+  {
+    close(process->pidfd);
+  }
+  free(process);
+}
+
+/**
+ * Reads the name of a process, which the exec event does not carry.
+ */
+static int read_comm(pid_t pid, char *comm)
+{
+  char path[64];
+  ssize_t length;
+  int file_descriptor;
+
+  snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+  file_descriptor = open(path, O_RDONLY);
+  if(file_descriptor < 0)
+  {
+    return -1;
+  }
+  length = read(file_descriptor, comm, COMM_LENGTH - 1);
+  close(file_descriptor);
+  if(length <= 0)
+  {
+    return -1;
+  }
+  comm[length] = '\0';
+  if(comm[length - 1] == '\n')
+  {
+    comm[length - 1] = '\0';
+  }
+
+  return 0;
+}
+
+/**
+ * Reports and forgets a followed process.
+ * @handled_ns: when the later of its pidfd wakeup and its exit event was
+ *              handled, 0 if it is forgotten without both. The exit latency
+ *              runs from the exit event to then, so an exit event that comes
+ *              in after the pidfd counts with its whole delay.
+ */
+static void report_exit(watched_process_t *process, uint64_t handled_ns)
+{
+  if(handled_ns)
+  {
+    uint64_t latency = handled_ns - process->exit_event_ns;
+    record_sample(&exit_latencies, latency);
+    printf("Process %s with pid %d exited (noticed after %.1f us)\n", process->comm, process->pid, latency / 1e3);
+  }
+  else
+  {
+    printf("Process %s with pid %d exited\n", process->comm, process->pid);
+  }
+
+  forget_watched(process);
+}
+
+/**
+ * Starts following pid, which has just been seen with a wanted name.
+ * @event_ns: kernel timestamp of the event it was seen in, 0 for processes
+ *            that were already running when the watcher started
+ */
+static void watch_process(int epoll_descriptor, pid_t pid, const char *comm, const char *reason, uint64_t event_ns)
+{
+  struct epoll_event event = { .events = EPOLLIN };
+  watched_process_t *process = find_watched(pid);
+  int pidfd;
+
+  if(process != NULL)
+  {
+    if(process->pidfd >= 0)
+    {
+      return;
+    }
+    // The pid was reused before the exit event of the old process came in
+    report_exit(process, 0);
+  }
+
+  pidfd = syscall(SYS_pidfd_open, pid, 0);
+  if(pidfd < 0)
+  {
+    // Nothing is kept for it, so nothing waits for an exit event that may already be gone
+    if(errno == ESRCH)
+    {
+      printf("Process %s with pid %d exited before it could be followed\n", comm, pid);
+    }
+    else
+    {
+      fprintf(stderr, "[!] Could not follow process %s with pid %d: %s\n", comm, pid, strerror(errno));
+    }
+    return;
+  }
+
+  process = calloc(1, sizeof(watched_process_t));
+  if(process == NULL)
+  {
+    perror("Failed to allocate a watched process");
+    close(pidfd);
+    return;
+  }
+  process->pid = pid;
+  process->pidfd = pidfd;
+  strncpy(process->comm, comm, COMM_LENGTH - 1);
+
+  event.data.ptr = process;
+  if(epoll_ctl(epoll_descriptor, EPOLL_CTL_ADD, process->pidfd, &event) < 0)
+  {
+    // Its exit could never be noticed, so it is not followed at all
+    fprintf(stderr, "[!] Could not follow process %s with pid %d: %s\n", comm, pid, strerror(errno));
+    close(pidfd);
+    free(process);
+    return;
+  }
+
+  process->next = watched[pid % WATCH_HASH_SIZE];
+  watched[pid % WATCH_HASH_SIZE] = process;
+
+  if(event_ns)
+  {
+    uint64_t latency = now_in_ns() - event_ns;
+    record_sample(&detection_latencies, latency);
+    printf("Found process %s with pid %d (%s, detected after %.1f us)\n", comm, pid, reason, latency / 1e3);
+  }
+  else
+  {
+    printf("Found process %s with pid %d (%s)\n", comm, pid, reason);
+  }
+}
+
+/**
+ * Handles the pidfd of a followed process becoming readable. exit_notify()
+ * wakes pidfd pollers before proc_exit_connector() queues the exit event,
+ * so the event may still be on its way; then the process is kept, without
+ * its pidfd, until the event comes in.
+ */
+static void process_exited(watched_process_t *process)
+{
+  // Closing it also takes it out of the epoll set
+  close(process->pidfd);
+  process->pidfd = -1;
+
+  if(process->exit_event_ns)
+  {
+    report_exit(process, now_in_ns());
+  }
+}
+
+/**
+ * Forgets the processes that exited but whose exit event has not come in,
+ * after the socket overflowed and the events may be lost.
+ */
+static void forget_exited(void)
+{
+  watched_process_t *process, *next;
+  int bucket;
+
+  for(bucket = 0; bucket < WATCH_HASH_SIZE; bucket++)
+  {
+    for(process = watched[bucket]; process != NULL; process = next)
+    {
+      next = process->next;
+      if(process->pidfd < 0)
+      {
+        report_exit(process, 0);
+      }
+    }
+  }
+}
+
+static void handle_proc_event(int epoll_descriptor, const struct proc_event *event)
+{
+  watched_process_t *process;
+  char comm[COMM_LENGTH];
+
+  switch(event->what)
+  {
+    case PROC_EVENT_FORK:
+      // A new process, not a thread, starts with the name of its parent
+      if(event->event_data.fork.child_pid == event->event_data.fork.child_tgid &&
+         (process = find_watched(event->event_data.fork.parent_tgid)) != NULL)
+      {
+        watch_process(epoll_descriptor, event->event_data.fork.child_tgid, process->comm, "fork",
+                      event->timestamp_ns);
+      }
+      break;
+    case PROC_EVENT_EXEC:
+      if(read_comm(event->event_data.exec.process_tgid, comm) == 0 && is_wanted(comm))
+      {
+        watch_process(epoll_descriptor, event->event_data.exec.process_tgid, comm, "exec", event->timestamp_ns);
+      }
+      break;
+    case PROC_EVENT_COMM:
+      // Only the name of the main thread is the name of the process
+      if(event->event_data.comm.process_pid == event->event_data.comm.process_tgid &&
+         is_wanted(event->event_data.comm.comm))
+      {
+        watch_process(epoll_descriptor, event->event_data.comm.process_tgid, event->event_data.comm.comm, "rename",
+                      event->timestamp_ns);
+      }
+      break;
+    case PROC_EVENT_EXIT:
+      if(event->event_data.exit.process_pid == event->event_data.exit.process_tgid &&
+         (process = find_watched(event->event_data.exit.process_tgid)) != NULL)
+      {
+        process->exit_event_ns = event->timestamp_ns;
+        if(process->pidfd < 0)
+        {
+          report_exit(process, now_in_ns());
+        }
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+/**
+ * Handles every message queued on the proc connector socket.
+ */
+static void drain_connector(int epoll_descriptor, int socket_descriptor)
+{
+  char buffer[RECEIVE_BUFFER_LENGTH] __attribute__((aligned(NLMSG_ALIGNTO)));
+  struct nlmsghdr *header;
+  ssize_t length;
+
+  while((length = recv(socket_descriptor, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+  {
+    for(header = (struct nlmsghdr *)buffer; NLMSG_OK(header, length); header = NLMSG_NEXT(header, length))
+    {
+      struct cn_msg *message = NLMSG_DATA(header);
+
+      if(header->nlmsg_type == NLMSG_ERROR || header->nlmsg_type == NLMSG_NOOP)
+      {
+        continue;
+      }
+      if(message->id.idx == CN_IDX_PROC && message->id.val == CN_VAL_PROC)
+      {
+        handle_proc_event(epoll_descriptor, (const struct proc_event *)message->data);
+      }
+    }
+  }
+  if(length < 0 && errno == ENOBUFS)
+  {
+    fprintf(stderr, "[!] Events were dropped, the socket buffer overflowed\n");
+    forget_exited();
+  }
+}
+
+/**
+ * Opens the proc connector and subscribes to its events.
+ */
+static int open_connector(void)
+{
+  struct __attribute__((aligned(NLMSG_ALIGNTO)))
+  {
+    struct nlmsghdr header;
+    struct __attribute__((packed))
+    {
+      struct cn_msg message;
+      enum proc_cn_mcast_op operation;
+    };
+  } request;
+  struct sockaddr_nl address = { .nl_family = AF_NETLINK, .nl_groups = CN_IDX_PROC, .nl_pid = getpid() };
+  int socket_descriptor, size = 4 * 1024 * 1024;
+
+  socket_descriptor = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+  if(socket_descriptor < 0)
+  {
+    return -1;
+  }
+  // Bursts of forks must not overflow the socket before they are read
+  setsockopt(socket_descriptor, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+  if(bind(socket_descriptor, (struct sockaddr *)&address, sizeof(address)) < 0)
+  {
+    close(socket_descriptor);
+    return -1;
+  }
+
+  memset(&request, 0, sizeof(request));
+  request.header.nlmsg_len = sizeof(request);
+  request.header.nlmsg_pid = getpid();
+  request.header.nlmsg_type = NLMSG_DONE;
+  request.message.id.idx = CN_IDX_PROC;
+  request.message.id.val = CN_VAL_PROC;
+  request.message.len = sizeof(enum proc_cn_mcast_op);
+  request.operation = PROC_CN_MCAST_LISTEN;
+
+  if(send(socket_descriptor, &request, sizeof(request), 0) < 0)
+  {
+    close(socket_descriptor);
+    return -1;
+  }
+
+  return socket_descriptor;
+}
+
+/**
+ * Follows the processes that already had a wanted name before the watcher
+ * subscribed. This is the only walk of /proc, everything later comes as an
+ * event.
+ */
+static void scan_running_processes(int epoll_descriptor)
+{
+  char comm[COMM_LENGTH];
+  struct dirent *entry;
+  DIR *directory;
+  pid_t pid;
+
+  directory = opendir("/proc");
+  if(directory == NULL)
+  {
+    return;
+  }
+  while((entry = readdir(directory)) != NULL)
+  {
+    pid = atoi(entry->d_name);
+    if(pid > 0 && read_comm(pid, comm) == 0 && is_wanted(comm))
+    {
+      watch_process(epoll_descriptor, pid, comm, "running", 0);
+    }
+  }
+  closedir(directory);
+}
+
+static void print_usage(const char *program)
+{
+  fprintf(stderr, "[!] Usage: %s [-d seconds] name...\n", program);
+  fprintf(stderr, "    -d <seconds>    stop after this long (default: until interrupted)\n");
+}
+
+int main(int argc, char *argv[])
+{
+  struct epoll_event events[MAX_EVENTS];
+  struct epoll_event event = { .events = EPOLLIN };
+  struct sigaction action = { .sa_handler = handle_signal };
+  double duration_seconds = 0;
+  uint64_t deadline = 0;
+  int socket_descriptor, epoll_descriptor, option, count, timeout, i;
+
+  while((option = getopt(argc, argv, "d:")) != -1)
+  {
+    switch(option)
+    {
+      case 'd':
+        duration_seconds = atof(optarg);
+        break;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+  if(optind == argc || duration_seconds < 0)
+  {
+    print_usage(argv[0]);
+    return 1;
+  }
+  wanted_names = &argv[optind];
+  number_of_wanted = argc - optind;
+
+  // No SA_RESTART, so epoll_wait returns on Ctrl-C and the summary is printed
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  socket_descriptor = open_connector();
+  if(socket_descriptor < 0)
+  {
+    perror("Failed to subscribe to the proc connector (needs root)");
+    return errno;
+  }
+  epoll_descriptor = epoll_create1(EPOLL_CLOEXEC);
+  if(epoll_descriptor < 0)
+  {
+    perror("Failed to create the epoll instance");
+    return errno;
+  }
+  event.data.ptr = NULL;   // The connector, pidfds carry their watched_process_t
+  if(epoll_ctl(epoll_descriptor, EPOLL_CTL_ADD, socket_descriptor, &event) < 0)
+  {
+    perror("Failed to wait for the proc connector");
+    return errno;
+  }
+
+  // Subscribed first, so a process started during the scan is not missed
+  scan_running_processes(epoll_descriptor);
+
+  if(duration_seconds > 0)
+  {
+    deadline = now_in_ns() + (uint64_t)(duration_seconds * 1e9);
+  }
+
+  while(!stop_requested)
+  {
+    timeout = -1;
+    if(deadline)
+    {
+      uint64_t now = now_in_ns();
+      if(now >= deadline)
+      {
+        break;
+      }
+      timeout = (deadline - now + 999999) / 1000000;
+    }
+
+    count = epoll_wait(epoll_descriptor, events, MAX_EVENTS, timeout);
+    if(count < 0)
+    {
+      if(errno == EINTR)
+      {
+        continue;
+      }
+      perror("Failed to wait for events");
+      break;
+    }
+
+    // Only processes whose pidfd woke in an earlier round can be forgotten
+    // here, so the pidfd events below still point at live entries
+    drain_connector(epoll_descriptor, socket_descriptor);
+
+    for(i = 0; i < count; i++)
+    {
+      if(events[i].data.ptr != NULL)
+      {
+        process_exited(events[i].data.ptr);
+      }
+    }
+  }
+
+  print_samples("Detection latency", &detection_latencies);
+  print_samples("Exit latency", &exit_latencies);
+
+  close(epoll_descriptor);
+  close(socket_descriptor);
+
+  return 0;
+}
@@ -1,8 +1,87 @@
 #include <linux/ioctl.h>
+#include <linux/types.h>
 
 #define TESTCHAR_IOC_MAGIC 'j'
 #define TESTCHAR_IOCRESET _IO(TESTCHAR_IOC_MAGIC, 0)
 #define TESTCHAR_ALLLOWER _IO(TESTCHAR_IOC_MAGIC, 1)
 #define TESTCHAR_ALLUPPER _IO(TESTCHAR_IOC_MAGIC, 2)
 #define TESTCHAR_ALLCAPS  _IO(TESTCHAR_IOC_MAGIC, 3)
-#define TESTCHAR_NONE     _IO(TESTCHAR_IOC_MAGIC, 4)
\ No newline at end of file
+#define TESTCHAR_NONE     _IO(TESTCHAR_IOC_MAGIC, 4)
+
+/**
+ * Argument of TESTCHAR_TRANSFORM. Converts input with the given mode and
+ * stores the result, "(N letters)" suffix included, in output: the same
+ * bytes a write(), ioctl(mode) and read() round trip would return, but in
+ * one system call. Pointers are passed as __u64 so 32 and 64 bit programs
+ * share the layout.
+ */
+struct testchar_transform
+{
+  __u64 input;          ///< User pointer to the message
+  __u64 output;         ///< User pointer to the buffer that receives the result
+  __u32 input_size;     ///< Number of bytes in input
+  __u32 output_size;    ///< Number of bytes available in output
+  __u32 mode;           ///< TESTCHAR_ALLLOWER, TESTCHAR_ALLUPPER, TESTCHAR_ALLCAPS or TESTCHAR_NONE
+  __u32 result_size;    ///< Set by the driver, the full result size even if output was too small
+};
+
+/**
+ * Argument of TESTCHAR_TRANSFORM_BATCH, many transforms in one call.
+ */
+struct testchar_transform_batch
+{
+  __u64 requests;       ///< User pointer to an array of struct testchar_transform
+  __u32 count;          ///< Number of requests in the array
+  __u32 completed;      ///< Set by the driver, requests done before the first error
+};
+
+#define TESTCHAR_TRANSFORM_BATCH_MAX 4096   ///< Most requests one TESTCHAR_TRANSFORM_BATCH takes
+
+#define TESTCHAR_TRANSFORM       _IOWR(TESTCHAR_IOC_MAGIC, 5, struct testchar_transform)
+#define TESTCHAR_TRANSFORM_BATCH _IOWR(TESTCHAR_IOC_MAGIC, 6, struct testchar_transform_batch)
+
+#define TESTCHAR_PIPELINE_MAX_STEPS 16
+#define TESTCHAR_PIPELINE_MAX_CAPS  2   ///< Every caps step doubles the states of the compiled pipeline
+
+/**
+ * Steps of a TESTCHAR_SET_PIPELINE pipeline, applied in order.
+ */
+enum testchar_step_type
+{
+  TESTCHAR_STEP_LOWER = 1,  ///< tolower()
+  TESTCHAR_STEP_UPPER,      ///< toupper()
+  TESTCHAR_STEP_ROT13,      ///< Rotates ASCII letters by 13
+  TESTCHAR_STEP_CAPS,       ///< toupper() on the first byte and every byte after a space
+  TESTCHAR_STEP_REPLACE,    ///< Replaces bytes in classes with replacement
+  TESTCHAR_STEP_KEEP        ///< Replaces bytes not in classes with replacement
+};
+
+/// Byte classes of TESTCHAR_STEP_REPLACE and TESTCHAR_STEP_KEEP
+#define TESTCHAR_CLASS_UPPER 0x01   ///< 'A'..'Z'
+#define TESTCHAR_CLASS_LOWER 0x02   ///< 'a'..'z'
+#define TESTCHAR_CLASS_DIGIT 0x04   ///< '0'..'9'
+#define TESTCHAR_CLASS_SPACE 0x08   ///< ' ', '\t', '\n', '\v', '\f', '\r'
+#define TESTCHAR_CLASS_PUNCT 0x10   ///< Every other printable ASCII byte
+#define TESTCHAR_CLASS_CNTRL 0x20   ///< Other bytes below 0x20, and 0x7f
+#define TESTCHAR_CLASS_HIGH  0x40   ///< Bytes 0x80..0xff
+#define TESTCHAR_CLASS_ALPHA (TESTCHAR_CLASS_UPPER | TESTCHAR_CLASS_LOWER)
+
+struct testchar_step
+{
+  __u8 type;            ///< One of enum testchar_step_type
+  __u8 replacement;     ///< Byte written by TESTCHAR_STEP_REPLACE and TESTCHAR_STEP_KEEP
+  __u16 classes;        ///< TESTCHAR_CLASS_* mask of TESTCHAR_STEP_REPLACE and TESTCHAR_STEP_KEEP
+};
+
+/**
+ * Argument of TESTCHAR_SET_PIPELINE. Makes the open file convert messages
+ * with the steps in order instead of one of the fixed modes; the fixed mode
+ * ioctls switch back. A pipeline without steps leaves messages unchanged.
+ */
+struct testchar_pipeline
+{
+  __u32 count;          ///< Number of steps used
+  struct testchar_step steps[TESTCHAR_PIPELINE_MAX_STEPS];
+};
+
+#define TESTCHAR_SET_PIPELINE    _IOW(TESTCHAR_IOC_MAGIC, 7, struct testchar_pipeline)
\ No newline at end of file
@@ -0,0 +1,195 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+/**
+ * Compiles a TESTCHAR_SET_PIPELINE pipeline into translation tables, shared
+ * by the testchar driver and the user space benchmark.
+ *
+ * Every step except caps maps one byte to one byte, so any chain of them is
+ * again one byte map: the whole chain becomes a single 256 entry table and
+ * converting a message costs one lookup per byte, however many steps it has.
+ *
+ * A caps step also depends on the byte its step saw at the previous position,
+ * which only matters as "was it a space". That is one bit of state per caps
+ * step, so a pipeline with k caps steps compiles into a 2^k state machine:
+ * output[state][byte] is the converted byte and next[state][byte] the state
+ * for the following byte. The start state has every bit set, since the first
+ * byte of a message is capitalized as if it followed a space.
+ */
+
+#include "commands.h"
+#include "transform.h"
+
+#ifdef __KERNEL__
+#include <linux/errno.h>
+#else
+#include <errno.h>
+#endif
+
+#define PIPELINE_MAX_STATES (1 << TESTCHAR_PIPELINE_MAX_CAPS)
+
+struct pipeline_program
+{
+  unsigned int number_of_states;                   ///< 1 when the pipeline has no caps step
+  unsigned char output[PIPELINE_MAX_STATES][256];  ///< Converted byte for every state and input byte
+  unsigned char next[PIPELINE_MAX_STATES][256];    ///< State after every state and input byte
+};
+
+static inline int pipeline_in_classes(unsigned char byte, unsigned int classes)
+{
+  unsigned int class;
+
+  if(byte >= 0x80)
+  {
+    class = TESTCHAR_CLASS_HIGH;
+  }
+  else if(byte >= 'A' && byte <= 'Z')
+  {
+    class = TESTCHAR_CLASS_UPPER;
+  }
+  else if(byte >= 'a' && byte <= 'z')
+  {
+    class = TESTCHAR_CLASS_LOWER;
+  }
+  else if(byte >= '0' && byte <= '9')
+  {
+    class = TESTCHAR_CLASS_DIGIT;
+  }
+  else if(byte == ' ' || (byte >= '\t' && byte <= '\r'))
+  {
+    class = TESTCHAR_CLASS_SPACE;
+  }
+  else if(byte < 0x20 || byte == 0x7f)
+  {
+    class = TESTCHAR_CLASS_CNTRL;
+  }
+  else
+  {
+    class = TESTCHAR_CLASS_PUNCT;
+  }
+
+  return (classes & class) != 0;
+}
+
+/**
+ * Applies one step that does not depend on its neighbours to byte.
+ */
+static inline unsigned char pipeline_map(const struct testchar_step *step, unsigned char byte)
+{
+  switch(step->type)
+  {
+    case TESTCHAR_STEP_LOWER:
+      return tolower(byte);
+    case TESTCHAR_STEP_UPPER:
+      return toupper(byte);
+    case TESTCHAR_STEP_ROT13:
+      if((byte >= 'a' && byte <= 'z') || (byte >= 'A' && byte <= 'Z'))
+      {
+        unsigned char base = byte >= 'a' ? 'a' : 'A';
+        return base + (byte - base + 13) % 26;
+      }
+      return byte;
+    case TESTCHAR_STEP_REPLACE:
+      return pipeline_in_classes(byte, step->classes) ? step->replacement : byte;
+    case TESTCHAR_STEP_KEEP:
+      return pipeline_in_classes(byte, step->classes) ? byte : step->replacement;
+    default:
+      return byte;
+  }
+}
+
+/**
+ * Checks pipeline and fills program with its tables.
+ * @return 0, or -EINVAL for an unknown step or too many (caps) steps
+ */
+static inline int pipeline_compile(const struct testchar_pipeline *pipeline, struct pipeline_program *program)
+{
+  unsigned int i, state, byte, number_of_caps = 0;
+
+  if(pipeline->count > TESTCHAR_PIPELINE_MAX_STEPS)
+  {
+    return -EINVAL;
+  }
+  for(i = 0; i < pipeline->count; i++)
+  {
+    if(pipeline->steps[i].type < TESTCHAR_STEP_LOWER || pipeline->steps[i].type > TESTCHAR_STEP_KEEP)
+    {
+      return -EINVAL;
+    }
+    if(pipeline->steps[i].type == TESTCHAR_STEP_CAPS)
+    {
+      number_of_caps++;
+    }
+  }
+  if(number_of_caps > TESTCHAR_PIPELINE_MAX_CAPS)
+  {
+    return -EINVAL;
+  }
+
+  program->number_of_states = 1 << number_of_caps;
+  for(state = 0; state < program->number_of_states; state++)
+  {
+    for(byte = 0; byte < 256; byte++)
+    {
+      unsigned char current = byte;
+      unsigned int next_state = 0, caps_bit = 0;
+
+      for(i = 0; i < pipeline->count; i++)
+      {
+        const struct testchar_step *step = &pipeline->steps[i];
+
+        if(step->type != TESTCHAR_STEP_CAPS)
+        {
+          current = pipeline_map(step, current);
+          continue;
+        }
+
+        // What this caps step sees now is the "previous byte" of the next one
+        if(current == ' ')
+        {
+          next_state |= 1 << caps_bit;
+        }
+        if(state & (1 << caps_bit))
+        {
+          current = toupper(current);
+        }
+        caps_bit++;
+      }
+
+      program->output[state][byte] = current;
+      program->next[state][byte] = next_state;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Converts size bytes of original into modified, which may be the same buffer.
+ */
+static inline void pipeline_run(const struct pipeline_program *program, const char *original, char *modified, size_t size)
+{
+  unsigned int state = program->number_of_states - 1;
+  size_t i;
+
+  if(program->number_of_states == 1)
+  {
+    const unsigned char *table = program->output[0];
+
+    for(i = 0; i < size; i++)
+    {
+      modified[i] = table[(unsigned char)original[i]];
+    }
+    return;
+  }
+
+  for(i = 0; i < size; i++)
+  {
+    unsigned char current = original[i];
+
+    modified[i] = program->output[state][current];
+    state = program->next[state][current];
+  }
+}
+
+#endif
@@ -7,50 +7,184 @@
 #include <asm/uaccess.h>
 #include <linux/uaccess.h>
 #include "commands.h"
+#include "transform.h"
+#include "pipeline.h"
 #include <linux/ctype.h>
 #include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/uio.h>
+#include <linux/sched.h>
+#include <linux/kref.h>
+#include <linux/rcupdate.h>
+#include <linux/srcu.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
 
 #define DEVICE_NAME "testchar"
 #define CLASS_NAME  "test"
 
+#define INITIAL_MESSAGE_SIZE 256          ///< Every open starts with a buffer this big
+#define MAX_MESSAGE_SIZE     (1 << 20)    ///< Upper bound for the growable message buffer
+#define LETTERS_SUFFIX_SIZE  32           ///< Room for the "(N letters)" suffix
+
 MODULE_AUTHOR("Javier Vega");
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("A character device driver");
 MODULE_VERSION("1.0");
 
 /**
- * A macro that is used to declare a new mutex that is visible in this file
- * results in a semaphore variable ebbchar_mutex with value 1 (unlocked)
- * DEFINE_MUTEX_LOCKED() results in a variable with value 0 (locked)
+ * One published version of the transformed message of an open file.
+ * A snapshot never changes once it is published: writers build a new one
+ * and swap the pointer, readers copy from whichever version they picked up,
+ * so no reader ever sees half of one message and half of another.
+ */
+struct testchar_snapshot
+{
+  struct kref refcount;                   ///< Held by the open file while published and by every mmap
+  struct rcu_head rcu;                    ///< Defers the free until no reader can still be copying
+  unsigned long generation;               ///< Bumped every time the message or the mode changes
+  size_t size_of_result;                  ///< Number of valid bytes in result
+  char *mapped;                           ///< vmalloc_user() copy of result, built by the first mmap
+  char result[];                          ///< Transformed message, allocated with the snapshot
+};
+
+/**
+ * Per-open state stored in file->private_data. Each open file gets its own
+ * message buffer and transform mode, so any number of processes can use the
+ * device at the same time without seeing each other's data. The mutex only
+ * serializes writers that share the same open file (threads, dup, fork);
+ * readers go straight to the published snapshot and never take it.
+ * Readers that already saw the end of a result sleep on wait until the
+ * next snapshot is published.
  */
-static DEFINE_MUTEX(testchar_mutex);
+struct testchar_file
+{
+  struct mutex lock;                      ///< Protects the writer side fields below
+  char *message;                          ///< Memory for the string that is passed from userspace
+  size_t size_of_message;                 ///< Used to remember the size of the string stored
+  size_t capacity;                        ///< Number of bytes allocated for message
+  int device_mode;                        ///< Transform applied to the message
+  struct pipeline_program *program;       ///< Used while device_mode is TESTCHAR_SET_PIPELINE
+  struct testchar_snapshot __rcu *snapshot; ///< What readers currently see
+  wait_queue_head_t wait;                 ///< Readers and pollers waiting for a new snapshot
+  unsigned long read_generation;          ///< Generation the file position refers to
+  unsigned long consumed_generation;      ///< Last generation a read reported the end of
+};
+
+/**
+ * Readers copy straight from a snapshot into user memory, which can fault
+ * and sleep, so snapshots are freed through sleepable RCU instead of plain
+ * RCU. srcu_read_lock() only touches a per-CPU counter, so readers on
+ * different cores never bounce a shared cache line.
+ */
+static struct srcu_struct testchar_srcu;
+
+/**
+ * Usage counters. Each CPU bumps its own copy, so the hot paths never
+ * share a cache line; the sysfs attributes add the copies up when read.
+ */
+struct testchar_statistics
+{
+  unsigned long opens;                    ///< Counts the number of times the device is opened
+  unsigned long reads;                    ///< Read calls, including splice and readv
+  unsigned long writes;                   ///< Messages stored
+  unsigned long bytes_in;                 ///< Bytes received from user programs
+  unsigned long bytes_out;                ///< Bytes sent to user programs
+  unsigned long mode_switches;            ///< ioctls that changed the transform mode
+  unsigned long transforms;               ///< Strings converted by TESTCHAR_TRANSFORM(_BATCH)
+};
+
+static DEFINE_PER_CPU(struct testchar_statistics, testchar_statistics);
+
+#define count_statistic(field, value) this_cpu_add(testchar_statistics.field, value)
 
 static int major_number;                  ///< Stores the device number -- determined automatically
-static char message[256] = {0};           ///< Memory for the string that is passed from userspace
-static short size_of_message;             ///< Used to remember the size of the string stored
-static int number_of_opens = 0;           ///< Counts the number of times the device is opened
-static int device_mode = TESTCHAR_NONE;
 
 static struct class *testchar_class = NULL;   ///< The device-driver class struct pointer
 static struct device *testchar_device = NULL;  ///< The device-driver device struct pointer
 
+/**
+ * Defines a read only sysfs attribute that reports the sum of one
+ * statistics field over every CPU.
+ */
+#define TESTCHAR_STATISTIC_ATTR(field)                                                                  \
+  static ssize_t field##_show(struct device *device, struct device_attribute *attribute, char *buffer)  \
+  {                                                                                                     \
+    unsigned long total = 0;                                                                            \
+    int cpu;                                                                                            \
+    for_each_possible_cpu(cpu)                                                                          \
+    {                                                                                                   \
+      total += per_cpu(testchar_statistics, cpu).field;                                                 \
+    }                                                                                                   \
+    return sprintf(buffer, "%lu\n", total);                                                             \
+  }                                                                                                     \
+  static DEVICE_ATTR_RO(field)
+
+TESTCHAR_STATISTIC_ATTR(opens);
+TESTCHAR_STATISTIC_ATTR(reads);
+TESTCHAR_STATISTIC_ATTR(writes);
+TESTCHAR_STATISTIC_ATTR(bytes_in);
+TESTCHAR_STATISTIC_ATTR(bytes_out);
+TESTCHAR_STATISTIC_ATTR(mode_switches);
+TESTCHAR_STATISTIC_ATTR(transforms);
+
+static struct attribute *testchar_statistics_attributes[] = {
+  &dev_attr_opens.attr,
+  &dev_attr_reads.attr,
+  &dev_attr_writes.attr,
+  &dev_attr_bytes_in.attr,
+  &dev_attr_bytes_out.attr,
+  &dev_attr_mode_switches.attr,
+  &dev_attr_transforms.attr,
+  NULL
+};
+
+/// Shows up as /sys/class/test/testchar/statistics/
+static const struct attribute_group testchar_statistics_group = {
+  .name = "statistics",
+  .attrs = testchar_statistics_attributes
+};
+
+static const struct attribute_group *testchar_attribute_groups[] = {
+  &testchar_statistics_group,
+  NULL
+};
+
 // The prototype functions for the character driver -- must come before the struct definition
 static int dev_open(struct inode *, struct file *);
 static int dev_release(struct inode *, struct file *);
-static ssize_t dev_read(struct file *, char *, size_t, loff_t *);
-static ssize_t dev_write(struct file *, const char *, size_t, loff_t *);
+static ssize_t dev_read_iter(struct kiocb *, struct iov_iter *);
+static ssize_t dev_write_iter(struct kiocb *, struct iov_iter *);
 static long dev_ioctl(struct file *, unsigned int, unsigned long);
+static loff_t dev_llseek(struct file *, loff_t, int);
+static int dev_mmap(struct file *, struct vm_area_struct *);
+static __poll_t dev_poll(struct file *, struct poll_table_struct *);
+static int publish_snapshot(struct testchar_file *);
+static void put_snapshot(struct testchar_snapshot *);
 
 /** @brief Devices are represented as file structure in the kernel. The file_operations structure 
  *  from /linux/fs.h lists the callback functions that you wish to associated with your file operations
  *  using a C99 syntax structure. char devices usually implement open, read, write and release calls
+ *  Reads and writes go through iov_iter, which gives readv/writev in one call and lets the generic
+ *  helpers implement splice(2) and sendfile(2) on top of them. poll lets consumers wait for new
+ *  messages with poll/select/epoll instead of calling read in a loop.
  */
 static struct file_operations file_operations_t = {
+  .owner = THIS_MODULE,
   .open = dev_open,
-  .read = dev_read,
-  .write = dev_write,
+  .read_iter = dev_read_iter,
+  .write_iter = dev_write_iter,
+  .splice_read = generic_file_splice_read,
+  .splice_write = iter_file_splice_write,
   .release = dev_release,
-  .unlocked_ioctl = dev_ioctl
+  .unlocked_ioctl = dev_ioctl,
+  .llseek = dev_llseek,
+  .mmap = dev_mmap,
+  .poll = dev_poll
 };
 
 /** @brief The LKM initialization function
@@ -62,12 +196,24 @@ static struct file_operations file_operations_t = {
  */
 static int __init testchar_init(void)
 {
+  int error_number;
+
   printk(KERN_INFO "TestChar: Initializing the TestChar LKM\n");
 
+  error_number = init_srcu_struct(&testchar_srcu);
+  if(error_number < 0)
+  {
+    printk(KERN_ALERT "TestChar: Failed to initialize SRCU\n");
+
+    return error_number;
+  }
+
   // Try to dynamically allocate a major number for the device -- more difficult but worth it
   major_number = register_chrdev(0, DEVICE_NAME, &file_operations_t);
   if(major_number < 0)
   {
+    cleanup_srcu_struct(&testchar_srcu);
+
     printk(KERN_ALERT "TestChar failed to register a major number\n");
 
     return major_number;
@@ -79,6 +225,7 @@ static int __init testchar_init(void)
   if(IS_ERR(testchar_class))
   {
     unregister_chrdev(major_number, DEVICE_NAME);
+    cleanup_srcu_struct(&testchar_srcu);
 
     printk(KERN_ALERT "TestChar: Failed to register device class\n");
 
@@ -86,13 +233,15 @@ static int __init testchar_init(void)
   }
   printk(KERN_INFO "TestChar: device class registered correctly\n");
 
-  // Register the device driver
-  testchar_device = device_create(testchar_class, NULL, MKDEV(major_number, 0), NULL, DEVICE_NAME);
+  // Register the device driver, together with its statistics attributes
+  testchar_device = device_create_with_groups(testchar_class, NULL, MKDEV(major_number, 0), NULL,
+                                              testchar_attribute_groups, DEVICE_NAME);
   if (IS_ERR(testchar_device))
   {
     // Repeated code but the alternative is goto statements
     class_destroy(testchar_class);
     unregister_chrdev(major_number, DEVICE_NAME);
+    cleanup_srcu_struct(&testchar_srcu);
 
     printk(KERN_ALERT "TestChar: Failed to create the device\n");
 
@@ -100,28 +249,52 @@ static int __init testchar_init(void)
   }
   printk(KERN_INFO "TestChar: device class created correctly\n");
 
-  mutex_init(&testchar_mutex);       /// Initialize the mutex lock dynamically at runtime
-
   return 0;
 }
 
 /**
- * Allows users to open the device driver
+ * Allows users to open the device driver. Every open gets its own state,
+ * so there is no limit on how many clients use the device concurrently.
  */
 static int dev_open(struct inode *inode_ptr, struct file *file_ptr)
 {
-  /**
-   * Try to acquire the mutex (i.e., put the lock on/down)
-   * returns 1 if successful and 0 if there is contention
-   */
-  if(!mutex_trylock(&testchar_mutex)){
-    printk(KERN_ALERT "TestChar: Device in use by another process\n");
+  struct testchar_file *state;
+  int error_number;
 
-    return -EBUSY;
+  state = kzalloc(sizeof(*state), GFP_KERNEL);
+  if(!state)
+  {
+    return -ENOMEM;
   }
-  printk(KERN_INFO "TestChar: Driver have been opened\n");
 
-  number_of_opens++;
+  state->message = kzalloc(INITIAL_MESSAGE_SIZE, GFP_KERNEL);
+  if(!state->message)
+  {
+    kfree(state);
+    return -ENOMEM;
+  }
+  state->capacity = INITIAL_MESSAGE_SIZE;
+  state->device_mode = TESTCHAR_NONE;
+  mutex_init(&state->lock);
+  init_waitqueue_head(&state->wait);
+
+  // Readers always find a snapshot, even before the first write
+  mutex_lock(&state->lock);
+  error_number = publish_snapshot(state);
+  mutex_unlock(&state->lock);
+  if(error_number < 0)
+  {
+    mutex_destroy(&state->lock);
+    kfree(state->message);
+    kfree(state);
+    return error_number;
+  }
+
+  file_ptr->private_data = state;
+
+  count_statistic(opens, 1);
+
+  printk(KERN_INFO "TestChar: Driver have been opened\n");
 
   return 0;   // Successfully opened
 }
@@ -131,140 +304,521 @@ static int dev_open(struct inode *inode_ptr, struct file *file_ptr)
  */
 static int dev_release(struct inode *inode_ptr, struct file *file_ptr)
 {
-  mutex_unlock(&testchar_mutex);          /// Releases the mutex (i.e., the lock goes up)
+  struct testchar_file *state = file_ptr->private_data;
+
+  // No reader or writer can run anymore, the file is going away
+  put_snapshot(rcu_dereference_protected(state->snapshot, 1));
+  mutex_destroy(&state->lock);
+  kfree(state->program);
+  kfree(state->message);
+  kfree(state);
 
   printk(KERN_INFO "TestChar: Device successfully closed\n");
 
   return 0;   // Sucessfully released
 }
 
-static void convert_to_lower(char *original, char *modified, short size)
+/**
+ * Makes sure a buffer of an open file can hold at least size bytes.
+ * Buffers grow in powers of two up to MAX_MESSAGE_SIZE plus the suffix.
+ * Must be called with state->lock held.
+ */
+static int reserve_buffer(char **buffer, size_t *capacity, size_t size)
+{
+  size_t new_capacity;
+  char *new_buffer;
+
+  if(size <= *capacity)
+  {
+    return 0;
+  }
+  if(size > MAX_MESSAGE_SIZE + LETTERS_SUFFIX_SIZE)
+  {
+    return -EFBIG;
+  }
+
+  new_capacity = roundup_pow_of_two(size);
+  new_buffer = krealloc(*buffer, new_capacity, GFP_KERNEL);
+  if(!new_buffer)
+  {
+    return -ENOMEM;
+  }
+
+  *buffer = new_buffer;
+  *capacity = new_capacity;
+
+  return 0;
+}
+
+/**
+ * Writes the transformed message followed by the "(N letters)" suffix into
+ * result, which needs room for size + LETTERS_SUFFIX_SIZE bytes. result may
+ * be the same buffer as message. The conversions use the 8 bytes per step
+ * SWAR kernels from transform.h; transform_bench.c checks them against the
+ * old bytewise loops. TESTCHAR_SET_PIPELINE runs the compiled program.
+ * @return the number of bytes written to result
+ */
+static size_t render_result(unsigned int mode, const struct pipeline_program *program,
+                            const char *message, char *result, size_t size)
 {
-  int i;
-  for(i = 0; i < size; i++)
+  switch(mode)
   {
-    modified[i] = tolower(original[i]);
+    case TESTCHAR_SET_PIPELINE:
+      pipeline_run(program, message, result, size);
+      break;
+    case TESTCHAR_ALLCAPS:
+      transform_caps(message, result, size);
+      break;
+    case TESTCHAR_ALLLOWER:
+      transform_lower(message, result, size);
+      break;
+    case TESTCHAR_ALLUPPER:
+      transform_upper(message, result, size);
+      break;
+    default:
+      if(result != message)
+      {
+        memcpy(result, message, size);
+      }
+      break;
   }
-  printk(KERN_INFO "TestChar: Message changed to ALLLOWER\n");
+
+  // The suffix is appended after the transformed bytes, never read back from the same buffer
+  return size + scnprintf(result + size, LETTERS_SUFFIX_SIZE, "(%zu letters)", size);
 }
 
-static void convert_to_upper(char *original, char *modified, short size)
+static void free_snapshot(struct rcu_head *rcu)
 {
-  int i;
-  for(i = 0; i < size; i++)
+  struct testchar_snapshot *snapshot = container_of(rcu, struct testchar_snapshot, rcu);
+
+  vfree(snapshot->mapped);
+  kvfree(snapshot);
+}
+
+static void release_snapshot(struct kref *refcount)
+{
+  struct testchar_snapshot *snapshot = container_of(refcount, struct testchar_snapshot, refcount);
+
+  // Readers that picked it up before it was replaced may still be copying from it
+  call_srcu(&testchar_srcu, &snapshot->rcu, free_snapshot);
+}
+
+static void put_snapshot(struct testchar_snapshot *snapshot)
+{
+  kref_put(&snapshot->refcount, release_snapshot);
+}
+
+/**
+ * Builds a new snapshot from the message and the current mode and
+ * publishes it. This is the only place the transforms run; dev_write_iter()
+ * and dev_ioctl() call it when they change the input, so reads are a plain
+ * copy. If it fails the previous snapshot stays published.
+ * Must be called with state->lock held.
+ */
+static int publish_snapshot(struct testchar_file *state)
+{
+  struct testchar_snapshot *snapshot, *old_snapshot;
+  size_t size = state->size_of_message;
+
+  // One kmalloc for small messages; only mmap needs the result in vmalloc space
+  snapshot = kvmalloc(struct_size(snapshot, result, size + LETTERS_SUFFIX_SIZE), GFP_KERNEL);
+  if(!snapshot)
   {
-    modified[i] = toupper(original[i]);
+    return -ENOMEM;
   }
-  printk(KERN_INFO "TestChar: Message changed to ALLUPER\n");
+  snapshot->mapped = NULL;
+  kref_init(&snapshot->refcount);
+
+  snapshot->size_of_result = render_result(state->device_mode, state->program, state->message,
+                                           snapshot->result, size);
+
+  old_snapshot = rcu_dereference_protected(state->snapshot, lockdep_is_held(&state->lock));
+  snapshot->generation = old_snapshot ? old_snapshot->generation + 1 : 1;
+
+  // Orders the contents above before the pointer becomes visible to readers
+  rcu_assign_pointer(state->snapshot, snapshot);
+
+  if(old_snapshot)
+  {
+    put_snapshot(old_snapshot);
+  }
+
+  // Both blocked readers and poll/epoll waiters are on this queue
+  wake_up_interruptible(&state->wait);
+
+  return 0;
+}
+
+/**
+ * Returns the generation of the snapshot that is published right now.
+ */
+static unsigned long current_generation(struct testchar_file *state)
+{
+  unsigned long generation;
+  int index;
+
+  index = srcu_read_lock(&testchar_srcu);
+  generation = srcu_dereference(state->snapshot, &testchar_srcu)->generation;
+  srcu_read_unlock(&testchar_srcu, index);
+
+  return generation;
 }
 
-static void convert_to_caps(char *original, char *modified, short size)
+/**
+ * Allows the device driver to send data to user programs. Reads start at
+ * the file position and advance it, so the result can be read in chunks.
+ * A result published by a write or an ioctl since the last read or seek is
+ * read from its start. The first read at the end of a result returns 0, so
+ * cat and friends stop as before. A further read at the end blocks until a
+ * new result is published and then returns it; with O_NONBLOCK it fails
+ * with -EAGAIN instead. Readers take no lock; they copy from the current
+ * snapshot inside an SRCU read section.
+ */
+static ssize_t dev_read_iter(struct kiocb *iocb, struct iov_iter *destination)
 {
-  int i = 0;
-  modified[i] = toupper(original[i]);
+  struct testchar_file *state = iocb->ki_filp->private_data;
+  struct testchar_snapshot *snapshot;
+  size_t length = 0, copied = 0;
+  unsigned long generation;
+  int index, error_number;
 
-  for(i = 1; i < size; i++)
+  for(;;)
   {
-    if(original[i - 1] == ' ')
+    index = srcu_read_lock(&testchar_srcu);
+    snapshot = srcu_dereference(state->snapshot, &testchar_srcu);
+    generation = snapshot->generation;
+
+    // The position belongs to the result it was read or seeked in
+    if(READ_ONCE(state->read_generation) != generation)
     {
-      modified[i] = toupper(original[i]);
+      WRITE_ONCE(state->read_generation, generation);
+      iocb->ki_pos = 0;
     }
-    else
+
+    if(iocb->ki_pos < snapshot->size_of_result)
     {
-      modified[i] = original[i];
+      length = min_t(size_t, snapshot->size_of_result - iocb->ki_pos, iov_iter_count(destination));
+
+      // copy_to_iter fills user iovecs or pipe pages alike and returns how much it copied
+      copied = copy_to_iter(snapshot->result + iocb->ki_pos, length, destination);
+      srcu_read_unlock(&testchar_srcu, index);
+      break;
+    }
+    srcu_read_unlock(&testchar_srcu, index);
+
+    // At the end of the result: report it once, then wait for the next one
+    if(READ_ONCE(state->consumed_generation) != generation)
+    {
+      WRITE_ONCE(state->consumed_generation, generation);
+      break;
+    }
+    if((iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT))
+    {
+      return -EAGAIN;
+    }
+
+    error_number = wait_event_interruptible(state->wait, current_generation(state) != generation);
+    if(error_number < 0)
+    {
+      return error_number;
     }
   }
 
-  printk(KERN_INFO "TestChar: Message changed to ALLCAPS\n");
+  count_statistic(reads, 1);
+  count_statistic(bytes_out, copied);
+
+  // A short copy still counts, the caller sees it as a short read
+  if(copied > 0 || length == 0)
+  {
+    printk(KERN_INFO "TestChar: Sent %zu characters to the user\n", copied);
+    iocb->ki_pos += copied;
+    return copied;
+  }
+  else
+  {
+    printk(KERN_INFO "TestChar: Could not send %zu characters to the user\n", length);
+    return -EFAULT;
+  }
 }
 
 /**
- * Allows the device driver to send data to user programs.
+ * Allows user programs to write data to the device driver.
+ * The message buffer of the open file grows to fit the data. Every write
+ * stores a whole new message and rewinds the file position, so the next
+ * read starts at the beginning of the new result. All segments of a writev,
+ * or all pipe buffers handed over by one splice, make up one message.
  */
-static ssize_t dev_read(struct file *file_ptr, char *user_buffer, size_t data_size, loff_t *offset_ptr)
+static ssize_t dev_write_iter(struct kiocb *iocb, struct iov_iter *source)
 {
-  int error_number = 0;
+  struct testchar_file *state = iocb->ki_filp->private_data;
+  size_t data_size = iov_iter_count(source);
+  int error_number;
+
+  if(data_size <= 0)
+  {
+    return -1;
+  }
+  printk(KERN_INFO "TestChar: Received %zu characters from the user\n", data_size);
+
+  mutex_lock(&state->lock);
+
+  error_number = reserve_buffer(&state->message, &state->capacity, data_size);
+  if(error_number < 0)
+  {
+    mutex_unlock(&state->lock);
+    return error_number;
+  }
+
+  if(!copy_from_iter_full(state->message, data_size, source))
+  {
+    mutex_unlock(&state->lock);
+    printk(KERN_INFO "TestChar: Error while writing\n");
+    return -EFAULT;
+  }
+  state->size_of_message = strnlen(state->message, data_size);
+  iocb->ki_pos = 0;
+
+  error_number = publish_snapshot(state);
+
+  mutex_unlock(&state->lock);
+
+  if(error_number < 0)
+  {
+    return error_number;
+  }
+
+  count_statistic(writes, 1);
+  count_statistic(bytes_in, data_size);
 
-  char modified_message[256] = {0};
+  // Report everything as consumed, otherwise splice would resend the bytes after a NUL
+  return data_size;
+}
+
+/**
+ * Runs one TESTCHAR_TRANSFORM request: copies the input in, converts it in
+ * place and copies the result, with its "(N letters)" suffix, back out.
+ * scratch is reused between the requests of a batch.
+ */
+static int transform_request(struct testchar_transform *request, char **scratch, size_t *scratch_capacity)
+{
+  size_t size, size_of_result;
+  int error_number;
 
-  switch(device_mode)
+  switch(request->mode)
   {
     case TESTCHAR_NONE:
-      sprintf(modified_message, "%s(%u letters)", message, size_of_message);
-      break;
     case TESTCHAR_ALLCAPS:
-      convert_to_caps(message, modified_message, size_of_message);
-      break;
     case TESTCHAR_ALLLOWER:
-      convert_to_lower(message, modified_message, size_of_message);
-      break;
     case TESTCHAR_ALLUPPER:
-      convert_to_upper(message, modified_message, size_of_message);
       break;
+    default:
+      return -EINVAL;
   }
-  if(device_mode != TESTCHAR_NONE)
+  if(request->input_size > MAX_MESSAGE_SIZE)
   {
-    sprintf(modified_message, "%s(%u letters)", modified_message, size_of_message);
+    return -EFBIG;
   }
 
-  // copy_to_user has the format ( * to, * from, size) and returns 0 on success
-  error_number = copy_to_user(user_buffer, modified_message, strlen(modified_message));
+  error_number = reserve_buffer(scratch, scratch_capacity, request->input_size + LETTERS_SUFFIX_SIZE);
+  if(error_number < 0)
+  {
+    return error_number;
+  }
 
-  // if true then have success
-  if(error_number == 0)
+  if(copy_from_user(*scratch, u64_to_user_ptr(request->input), request->input_size))
   {
-    printk(KERN_INFO "TestChar: Sent %d characters to the user\n", size_of_message);
-    return 0;
+    return -EFAULT;
   }
-  else
+  size = strnlen(*scratch, request->input_size);
+
+  size_of_result = render_result(request->mode, NULL, *scratch, *scratch, size);
+  if(copy_to_user(u64_to_user_ptr(request->output), *scratch, min_t(size_t, size_of_result, request->output_size)))
   {
-    printk(KERN_INFO "TestChar: Could not send %d characters to the user\n", error_number);
     return -EFAULT;
   }
+  // The full size tells the caller when the output buffer was too small
+  request->result_size = size_of_result;
+
+  count_statistic(transforms, 1);
+  count_statistic(bytes_in, request->input_size);
+  count_statistic(bytes_out, min_t(size_t, size_of_result, request->output_size));
+
+  return 0;
 }
 
 /**
- * Allows user programs to write data to the device driver.
+ * TESTCHAR_TRANSFORM: write, ioctl and read in a single kernel entry.
+ * It does not touch the message or mode of the open file.
  */
-static ssize_t dev_write(struct file *file_ptr, const char *data, size_t data_size, loff_t *offset_ptr)
+static long dev_transform(struct testchar_transform __user *user_request)
 {
-  unsigned long bytes_not_copied;
+  struct testchar_transform request;
+  char *scratch = NULL;
+  size_t scratch_capacity = 0;
+  int error_number;
 
-  if(data_size <= 0)
+  if(copy_from_user(&request, user_request, sizeof(request)))
   {
-    return -1;
+    return -EFAULT;
   }
-  printk(KERN_INFO "TestChar: Received %lu characters from the user\n", data_size);
 
-  bytes_not_copied = copy_from_user(message, data, data_size);
-  if(bytes_not_copied > 0)
+  error_number = transform_request(&request, &scratch, &scratch_capacity);
+  kfree(scratch);
+  if(error_number < 0)
   {
-    printk(KERN_INFO "TestChar: Error while writing\n");
-    return -1;
+    return error_number;
+  }
+
+  return put_user(request.result_size, &user_request->result_size);
+}
+
+/**
+ * TESTCHAR_TRANSFORM_BATCH: runs many TESTCHAR_TRANSFORM requests in one
+ * call. It stops at the first failing request, or with -EINTR when the
+ * caller is being killed; completed tells the caller how many requests
+ * were done. count is limited to TESTCHAR_TRANSFORM_BATCH_MAX.
+ */
+static long dev_transform_batch(struct testchar_transform_batch __user *user_batch)
+{
+  struct testchar_transform_batch batch;
+  struct testchar_transform request;
+  struct testchar_transform __user *user_requests;
+  char *scratch = NULL;
+  size_t scratch_capacity = 0;
+  int error_number = 0;
+  __u32 i;
+
+  if(copy_from_user(&batch, user_batch, sizeof(batch)))
+  {
+    return -EFAULT;
+  }
+  if(batch.count > TESTCHAR_TRANSFORM_BATCH_MAX)
+  {
+    return -EINVAL;
+  }
+  user_requests = u64_to_user_ptr(batch.requests);
+
+  for(i = 0; i < batch.count; i++)
+  {
+    if(fatal_signal_pending(current))
+    {
+      error_number = -EINTR;
+      break;
+    }
+
+    if(copy_from_user(&request, &user_requests[i], sizeof(request)))
+    {
+      error_number = -EFAULT;
+      break;
+    }
+
+    error_number = transform_request(&request, &scratch, &scratch_capacity);
+    if(error_number == 0)
+    {
+      error_number = put_user(request.result_size, &user_requests[i].result_size);
+    }
+    if(error_number < 0)
+    {
+      break;
+    }
+
+    // Long batches must not hog the CPU
+    cond_resched();
+  }
+  kfree(scratch);
+
+  if(put_user(i, &user_batch->completed))
+  {
+    return -EFAULT;
+  }
+
+  return error_number;
+}
+
+/**
+ * TESTCHAR_SET_PIPELINE: compiles the pipeline and makes it the mode of the
+ * open file. The compile runs before the lock is taken; a pipeline that does
+ * not compile leaves the current mode alone.
+ */
+static long dev_set_pipeline(struct testchar_file *state, const struct testchar_pipeline __user *user_pipeline)
+{
+  struct testchar_pipeline pipeline;
+  struct pipeline_program *program, *previous_program;
+  int previous_mode;
+  int error_number;
+
+  if(copy_from_user(&pipeline, user_pipeline, sizeof(pipeline)))
+  {
+    return -EFAULT;
+  }
+
+  program = kmalloc(sizeof(*program), GFP_KERNEL);
+  if(!program)
+  {
+    return -ENOMEM;
+  }
+  error_number = pipeline_compile(&pipeline, program);
+  if(error_number < 0)
+  {
+    kfree(program);
+    return error_number;
+  }
+
+  mutex_lock(&state->lock);
+  previous_program = state->program;
+  previous_mode = state->device_mode;
+  state->program = program;
+  state->device_mode = TESTCHAR_SET_PIPELINE;
+
+  error_number = publish_snapshot(state);
+  if(error_number < 0)
+  {
+    // Keep the mode in line with what readers see
+    state->program = previous_program;
+    state->device_mode = previous_mode;
+    previous_program = program;
+  }
+  else
+  {
+    count_statistic(mode_switches, 1);
   }
-  size_of_message = strlen(message);
+  mutex_unlock(&state->lock);
 
-  return size_of_message;
+  // Snapshots hold rendered bytes, nothing else points at the old program
+  kfree(previous_program);
+
+  if(error_number == 0)
+  {
+    printk(KERN_INFO "TestChar: Mode Changed to a %u step pipeline\n", pipeline.count);
+  }
+
+  return error_number;
 }
 
 static long dev_ioctl(struct file *file_ptr, unsigned int command, unsigned long arg)
 {
+  struct testchar_file *state = file_ptr->private_data;
+  int error_number = 0;
+  int previous_mode;
+
   switch(command)
   {
+    case TESTCHAR_TRANSFORM:
+      return dev_transform((struct testchar_transform __user *)arg);
+    case TESTCHAR_TRANSFORM_BATCH:
+      return dev_transform_batch((struct testchar_transform_batch __user *)arg);
+    case TESTCHAR_SET_PIPELINE:
+      return dev_set_pipeline(state, (const struct testchar_pipeline __user *)arg);
     case TESTCHAR_NONE:
-      device_mode = TESTCHAR_NONE;
       printk(KERN_INFO "TestChar: Mode Changed to None\n");
       break;
     case TESTCHAR_ALLCAPS:
-      device_mode = TESTCHAR_ALLCAPS;
       printk(KERN_INFO "TestChar: Mode Changed to ALLCAPS\n");
       break;
     case TESTCHAR_ALLLOWER:
-      device_mode = TESTCHAR_ALLLOWER;
       printk(KERN_INFO "TestChar: Mode Changed to ALLLOWER\n");
       break;
     case TESTCHAR_ALLUPPER:
-      device_mode = TESTCHAR_ALLUPPER;
       printk(KERN_INFO "TestChar: Mode Changed to ALLUPPER\n");
       break;
     default:
@@ -272,7 +826,147 @@ static long dev_ioctl(struct file *file_ptr, unsigned int command, unsigned long
       return -ENOTTY; 
   }
 
-  return 0;
+  mutex_lock(&state->lock);
+  if(state->device_mode != command)
+  {
+    previous_mode = state->device_mode;
+    state->device_mode = command;
+
+    error_number = publish_snapshot(state);
+    if(error_number < 0)
+    {
+      state->device_mode = previous_mode;   // Keep the mode in line with what readers see
+    }
+    else
+    {
+      count_statistic(mode_switches, 1);
+    }
+  }
+  mutex_unlock(&state->lock);
+
+  return error_number;
+}
+
+/**
+ * Lets user programs move the read position inside the result.
+ * SEEK_END is relative to the end of the current result, and the next read
+ * continues in that result rather than starting over.
+ */
+static loff_t dev_llseek(struct file *file_ptr, loff_t offset, int whence)
+{
+  struct testchar_file *state = file_ptr->private_data;
+  struct testchar_snapshot *snapshot;
+  size_t size_of_result;
+  unsigned long generation;
+  loff_t position;
+  int index;
+
+  index = srcu_read_lock(&testchar_srcu);
+  snapshot = srcu_dereference(state->snapshot, &testchar_srcu);
+  size_of_result = snapshot->size_of_result;
+  generation = snapshot->generation;
+  srcu_read_unlock(&testchar_srcu, index);
+
+  position = fixed_size_llseek(file_ptr, offset, whence, size_of_result);
+  if(position >= 0)
+  {
+    WRITE_ONCE(state->read_generation, generation);
+  }
+
+  return position;
+}
+
+/**
+ * Reports the device readable whenever a read would not block: there are
+ * bytes left in the result, a new result starts over from its beginning, or
+ * its end has not been reported yet. Writes
+ * never wait for readers, so the device is always writable.
+ */
+static __poll_t dev_poll(struct file *file_ptr, struct poll_table_struct *wait)
+{
+  struct testchar_file *state = file_ptr->private_data;
+  struct testchar_snapshot *snapshot;
+  __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+  int index;
+
+  poll_wait(file_ptr, &state->wait, wait);
+
+  index = srcu_read_lock(&testchar_srcu);
+  snapshot = srcu_dereference(state->snapshot, &testchar_srcu);
+  if(READ_ONCE(state->read_generation) != snapshot->generation ||
+     file_ptr->f_pos < snapshot->size_of_result ||
+     READ_ONCE(state->consumed_generation) != snapshot->generation)
+  {
+    mask |= EPOLLIN | EPOLLRDNORM;
+  }
+  srcu_read_unlock(&testchar_srcu, index);
+
+  return mask;
+}
+
+static void dev_vm_open(struct vm_area_struct *vma)
+{
+  struct testchar_snapshot *snapshot = vma->vm_private_data;
+
+  kref_get(&snapshot->refcount);
+}
+
+static void dev_vm_close(struct vm_area_struct *vma)
+{
+  put_snapshot(vma->vm_private_data);
+}
+
+static const struct vm_operations_struct testchar_vm_operations = {
+  .open = dev_vm_open,
+  .close = dev_vm_close
+};
+
+/**
+ * Maps the current result read only into the caller, so large results can
+ * be looked at without copying them. A mapping keeps the snapshot it was
+ * created from alive and always shows that one version; map again to see
+ * later writes. Use lseek(fd, 0, SEEK_END) to learn how many bytes are valid.
+ */
+static int dev_mmap(struct file *file_ptr, struct vm_area_struct *vma)
+{
+  struct testchar_file *state = file_ptr->private_data;
+  struct testchar_snapshot *snapshot;
+  int error_number;
+
+  if(vma->vm_flags & VM_WRITE)
+  {
+    return -EPERM;
+  }
+
+  // Holding the writer lock keeps the published snapshot from being dropped under us
+  mutex_lock(&state->lock);
+
+  snapshot = rcu_dereference_protected(state->snapshot, lockdep_is_held(&state->lock));
+
+  // The result never changes, so one page aligned copy serves every mapping of this snapshot
+  if(!snapshot->mapped)
+  {
+    snapshot->mapped = vmalloc_user(PAGE_ALIGN(snapshot->size_of_result));
+    if(!snapshot->mapped)
+    {
+      mutex_unlock(&state->lock);
+      return -ENOMEM;
+    }
+    memcpy(snapshot->mapped, snapshot->result, snapshot->size_of_result);
+  }
+
+  error_number = remap_vmalloc_range(vma, snapshot->mapped, vma->vm_pgoff);
+  if(error_number == 0)
+  {
+    vma->vm_flags &= ~VM_MAYWRITE;
+    vma->vm_ops = &testchar_vm_operations;
+    vma->vm_private_data = snapshot;
+    dev_vm_open(vma);
+  }
+
+  mutex_unlock(&state->lock);
+
+  return error_number;
 }
 
 /** @brief The LKM cleanup function
@@ -285,7 +979,8 @@ static void __exit testchar_exit(void)
   class_unregister(testchar_class);                       // unregister the device class
   class_destroy(testchar_class);                          // remove the device class
   unregister_chrdev(major_number, DEVICE_NAME);           // unregister the major number
-  mutex_destroy(&testchar_mutex);                         // destroy the dynamically-allocated mutex
+  srcu_barrier(&testchar_srcu);                           // wait for the last snapshots to be freed
+  cleanup_srcu_struct(&testchar_srcu);                    // release the SRCU bookkeeping
 
   printk(KERN_INFO "TestChar: Goodbye from the Device Driver!\n");
 }
@@ -5,11 +5,505 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include "commands.h"
 
 #define BUFFER_LENGTH 256               ///< The buffer length (crude but fine)
+#define DEVICE_PATH "/dev/testchar"
 
-int main(void)
+#define HISTOGRAM_SUB_BUCKET_BITS 4     ///< 16 sub-buckets per power of two, about 6% resolution
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+
+enum
+{
+  OperationWrite,
+  OperationIoctl,
+  OperationRead,
+  OperationTransform,   ///< TESTCHAR_TRANSFORM, write + ioctl + read in one call
+  OperationBatch,       ///< TESTCHAR_TRANSFORM_BATCH of batch_size messages
+  NumberOfOperations
+};
+
+static const char *operation_names[NumberOfOperations] = { "write", "ioctl", "read", "transform", "batch" };
+
+/**
+ * Latency histogram with logarithmic buckets, so recording is O(1) and the
+ * memory does not depend on how long the benchmark runs.
+ */
+typedef struct latency_histogram_t
+{
+  uint64_t count;
+  uint64_t errors;
+  uint64_t max_ns;
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+} latency_histogram_t;
+
+/**
+ * Everything one worker records. Workers write only to their own slot,
+ * which lives in shared memory so forked workers can report back too.
+ */
+typedef struct worker_result_t
+{
+  latency_histogram_t operations[NumberOfOperations];
+} worker_result_t;
+
+typedef struct benchmark_configuration_t
+{
+  int number_of_workers;
+  int use_processes;
+  size_t message_size;
+  unsigned int batch_size;
+  double duration_seconds;
+  unsigned int mix[NumberOfOperations];   ///< Relative weight of every operation
+  unsigned int mix_total;
+  const char *device_path;
+} benchmark_configuration_t;
+
+typedef struct worker_argument_t
+{
+  const benchmark_configuration_t *configuration;
+  worker_result_t *result;
+  unsigned int seed;
+} worker_argument_t;
+
+static uint64_t now_in_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static unsigned int bucket_of(uint64_t value)
+{
+  unsigned int magnitude;
+
+  if(value < HISTOGRAM_SUB_BUCKETS)
+  {
+    return value;
+  }
+  magnitude = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BUCKET_BITS;
+
+  return (magnitude + 1) * HISTOGRAM_SUB_BUCKETS + ((value >> magnitude) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/**
+ * Returns the largest value that falls into a bucket.
+ */
+static uint64_t bucket_upper_bound(unsigned int bucket)
+{
+  unsigned int magnitude;
+
+  if(bucket < HISTOGRAM_SUB_BUCKETS)
+  {
+    return bucket;
+  }
+  magnitude = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+
+  return (((uint64_t)(HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) + 1) << magnitude) - 1;
+}
+
+static void record_latency(latency_histogram_t *histogram, uint64_t latency_ns, int failed)
+{
+  histogram->count++;
+  histogram->buckets[bucket_of(latency_ns)]++;
+  if(latency_ns > histogram->max_ns)
+  {
+    histogram->max_ns = latency_ns;
+  }
+  if(failed)
+  {
+    histogram->errors++;
+  }
+}
+
+static void merge_histogram(latency_histogram_t *total, const latency_histogram_t *histogram)
+{
+  int i;
+
+  total->count += histogram->count;
+  total->errors += histogram->errors;
+  if(histogram->max_ns > total->max_ns)
+  {
+    total->max_ns = histogram->max_ns;
+  }
+  for(i = 0; i < HISTOGRAM_BUCKETS; i++)
+  {
+    total->buckets[i] += histogram->buckets[i];
+  }
+}
+
+static uint64_t percentile(const latency_histogram_t *histogram, double fraction)
+{
+  uint64_t target = (uint64_t)(fraction * histogram->count);
+  uint64_t seen = 0;
+  int i;
+
+  for(i = 0; i < HISTOGRAM_BUCKETS; i++)
+  {
+    seen += histogram->buckets[i];
+    if(seen > target)
+    {
+      return bucket_upper_bound(i) < histogram->max_ns ? bucket_upper_bound(i) : histogram->max_ns;
+    }
+  }
+
+  return histogram->max_ns;
+}
+
+/**
+ * Picks the next operation from the configured mix.
+ */
+static int next_operation(const benchmark_configuration_t *configuration, unsigned int *seed)
+{
+  unsigned int pick = rand_r(seed) % configuration->mix_total;
+  int operation;
+
+  for(operation = 0; operation < NumberOfOperations - 1; operation++)
+  {
+    if(pick < configuration->mix[operation])
+    {
+      break;
+    }
+    pick -= configuration->mix[operation];
+  }
+
+  return operation;
+}
+
+/**
+ * Runs the configured mix against its own open of the device until the
+ * duration is over. Every open has its own state in the driver, so workers
+ * only contend where the driver itself shares something.
+ */
+static void *run_worker(void *argument)
+{
+  static const unsigned int modes[] = { TESTCHAR_ALLLOWER, TESTCHAR_ALLUPPER, TESTCHAR_ALLCAPS, TESTCHAR_NONE };
+  worker_argument_t *worker = argument;
+  const benchmark_configuration_t *configuration = worker->configuration;
+  size_t receive_size = configuration->message_size + BUFFER_LENGTH;
+  struct testchar_transform *requests;
+  struct testchar_transform_batch batch;
+  char *message, *receive;
+  uint64_t deadline, start, stop;
+  unsigned int next_mode = 0;
+  int file_descriptor;
+  size_t i;
+
+  file_descriptor = open(configuration->device_path, O_RDWR);
+  if(file_descriptor < 0)
+  {
+    perror("Failed to open the device...");
+    return NULL;
+  }
+
+  message = malloc(configuration->message_size);
+  receive = malloc(receive_size * configuration->batch_size);
+  requests = calloc(configuration->batch_size, sizeof(struct testchar_transform));
+  if(message == NULL || receive == NULL || requests == NULL)
+  {
+    perror("Failed to allocate the message buffers");
+    close(file_descriptor);
+    return NULL;
+  }
+  for(i = 0; i < configuration->message_size; i++)
+  {
+    message[i] = (i % 6 == 5) ? ' ' : 'a' + rand_r(&worker->seed) % 26;
+  }
+
+  // The single transform uses requests[0], the batch all of them
+  for(i = 0; i < configuration->batch_size; i++)
+  {
+    requests[i].input = (uintptr_t)message;
+    requests[i].input_size = configuration->message_size;
+    requests[i].output = (uintptr_t)(receive + i * receive_size);
+    requests[i].output_size = receive_size;
+    requests[i].mode = modes[i % (sizeof(modes) / sizeof(modes[0]))];
+  }
+  batch.requests = (uintptr_t)requests;
+  batch.count = configuration->batch_size;
+
+  deadline = now_in_ns() + (uint64_t)(configuration->duration_seconds * 1e9);
+  do
+  {
+    int operation = next_operation(configuration, &worker->seed);
+    int failed = 0;
+
+    start = now_in_ns();
+    switch(operation)
+    {
+      case OperationWrite:
+        failed = write(file_descriptor, message, configuration->message_size) < 0;
+        break;
+      case OperationIoctl:
+        failed = ioctl(file_descriptor, modes[next_mode]) < 0;
+        next_mode = (next_mode + 1) % (sizeof(modes) / sizeof(modes[0]));
+        break;
+      case OperationRead:
+        failed = pread(file_descriptor, receive, receive_size, 0) < 0;
+        break;
+      case OperationTransform:
+        failed = ioctl(file_descriptor, TESTCHAR_TRANSFORM, &requests[0]) < 0;
+        break;
+      case OperationBatch:
+        failed = ioctl(file_descriptor, TESTCHAR_TRANSFORM_BATCH, &batch) < 0;
+        break;
+    }
+    stop = now_in_ns();
+
+    record_latency(&worker->result->operations[operation], stop - start, failed);
+  } while(stop < deadline);
+
+  free(message);
+  free(receive);
+  free(requests);
+  close(file_descriptor);
+
+  return NULL;
+}
+
+static void print_histogram_json(FILE *output, const latency_histogram_t *histogram, double duration_seconds)
+{
+  fprintf(output, "{ \"operations\": %llu, \"errors\": %llu, \"ops_per_second\": %.1f, "
+          "\"latency_ns\": { \"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu } }",
+          (unsigned long long)histogram->count, (unsigned long long)histogram->errors,
+          histogram->count / duration_seconds,
+          (unsigned long long)percentile(histogram, 0.50),
+          (unsigned long long)percentile(histogram, 0.99),
+          (unsigned long long)percentile(histogram, 0.999),
+          (unsigned long long)histogram->max_ns);
+}
+
+static void print_report(FILE *output, const benchmark_configuration_t *configuration,
+                         const worker_result_t *results, double elapsed_seconds)
+{
+  static latency_histogram_t totals[NumberOfOperations], overall;
+  int worker, operation;
+
+  for(worker = 0; worker < configuration->number_of_workers; worker++)
+  {
+    for(operation = 0; operation < NumberOfOperations; operation++)
+    {
+      merge_histogram(&totals[operation], &results[worker].operations[operation]);
+      merge_histogram(&overall, &results[worker].operations[operation]);
+    }
+  }
+
+  fprintf(output, "{\n");
+  fprintf(output, "  \"device\": \"%s\",\n", configuration->device_path);
+  fprintf(output, "  \"workers\": %d,\n", configuration->number_of_workers);
+  fprintf(output, "  \"worker_type\": \"%s\",\n", configuration->use_processes ? "processes" : "threads");
+  fprintf(output, "  \"message_size\": %zu,\n", configuration->message_size);
+  fprintf(output, "  \"batch_size\": %u,\n", configuration->batch_size);
+  fprintf(output, "  \"duration_seconds\": %.3f,\n", elapsed_seconds);
+  fprintf(output, "  \"mix\": {");
+  for(operation = 0; operation < NumberOfOperations; operation++)
+  {
+    fprintf(output, "%s \"%s\": %u", operation ? "," : "", operation_names[operation], configuration->mix[operation]);
+  }
+  fprintf(output, " },\n");
+  fprintf(output, "  \"total\": ");
+  print_histogram_json(output, &overall, elapsed_seconds);
+  fprintf(output, ",\n  \"by_operation\": {\n");
+  for(operation = 0; operation < NumberOfOperations; operation++)
+  {
+    fprintf(output, "    \"%s\": ", operation_names[operation]);
+    print_histogram_json(output, &totals[operation], elapsed_seconds);
+    fprintf(output, "%s\n", operation < NumberOfOperations - 1 ? "," : "");
+  }
+  fprintf(output, "  }\n}\n");
+}
+
+/**
+ * Parses a mix such as "write=2,ioctl=1,read=5" into operation weights.
+ */
+static int parse_mix(const char *text, benchmark_configuration_t *configuration)
+{
+  char *copy = strdup(text);
+  char *saveptr = NULL;
+  char *entry;
+  int operation;
+
+  memset(configuration->mix, 0, sizeof(configuration->mix));
+  configuration->mix_total = 0;
+
+  for(entry = strtok_r(copy, ",", &saveptr); entry != NULL; entry = strtok_r(NULL, ",", &saveptr))
+  {
+    char *equals = strchr(entry, '=');
+    if(equals == NULL)
+    {
+      break;
+    }
+    *equals = '\0';
+
+    for(operation = 0; operation < NumberOfOperations; operation++)
+    {
+      if(!strcmp(entry, operation_names[operation]))
+      {
+        configuration->mix[operation] = atoi(equals + 1);
+        configuration->mix_total += configuration->mix[operation];
+        break;
+      }
+    }
+    if(operation == NumberOfOperations)
+    {
+      fprintf(stderr, "[-] ERROR: Unknown operation %s in the mix\n", entry);
+      free(copy);
+      return -1;
+    }
+  }
+  free(copy);
+
+  return configuration->mix_total > 0 ? 0 : -1;
+}
+
+static void print_usage(const char *program)
+{
+  fprintf(stderr, "[!] Usage: %s                      interactive mode\n", program);
+  fprintf(stderr, "[!]        %s -b [options]         benchmark mode, JSON report on stdout\n", program);
+  fprintf(stderr, "    -w <workers>    number of concurrent workers (default 4)\n");
+  fprintf(stderr, "    -p              run workers as processes instead of threads\n");
+  fprintf(stderr, "    -m <mix>        operation weights over write, ioctl, read, transform and batch\n");
+  fprintf(stderr, "                    (default write=1,ioctl=1,read=1)\n");
+  fprintf(stderr, "    -s <bytes>      message size (default 64)\n");
+  fprintf(stderr, "    -n <messages>   messages per batch operation (default 16)\n");
+  fprintf(stderr, "    -d <seconds>    run duration (default 5)\n");
+  fprintf(stderr, "    -f <path>       device to use (default %s)\n", DEVICE_PATH);
+}
+
+/**
+ * Non-interactive stress mode. Starts the workers, waits for them and
+ * prints throughput and latency percentiles as JSON.
+ */
+static int run_benchmark(int argc, char *argv[])
+{
+  benchmark_configuration_t configuration =
+    {
+      .number_of_workers = 4,
+      .use_processes = 0,
+      .message_size = 64,
+      .batch_size = 16,
+      .duration_seconds = 5,
+      .device_path = DEVICE_PATH
+    };
+  worker_result_t *results;
+  worker_argument_t *arguments;
+  pthread_t *threads;
+  uint64_t start;
+  int option, worker;
+
+  parse_mix("write=1,ioctl=1,read=1", &configuration);
+
+  while((option = getopt(argc, argv, "bw:pm:s:n:d:f:")) != -1)
+  {
+    switch(option)
+    {
+      case 'b':
+        break;
+      case 'w':
+        configuration.number_of_workers = atoi(optarg);
+        break;
+      case 'p':
+        configuration.use_processes = 1;
+        break;
+      case 'm':
+        if(parse_mix(optarg, &configuration) < 0)
+        {
+          print_usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 's':
+        configuration.message_size = strtoul(optarg, NULL, 10);
+        break;
+      case 'n':
+        configuration.batch_size = strtoul(optarg, NULL, 10);
+        break;
+      case 'd':
+        configuration.duration_seconds = atof(optarg);
+        break;
+      case 'f':
+        configuration.device_path = optarg;
+        break;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+  if(configuration.number_of_workers <= 0 || configuration.message_size == 0 ||
+     configuration.batch_size == 0 || configuration.batch_size > TESTCHAR_TRANSFORM_BATCH_MAX ||
+     configuration.duration_seconds <= 0)
+  {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  // Shared anonymous memory so forked workers can hand their histograms back
+  results = mmap(NULL, configuration.number_of_workers * sizeof(worker_result_t),
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  arguments = calloc(configuration.number_of_workers, sizeof(worker_argument_t));
+  threads = calloc(configuration.number_of_workers, sizeof(pthread_t));
+  if(results == MAP_FAILED || arguments == NULL || threads == NULL)
+  {
+    perror("Failed to allocate the worker results");
+    return errno;
+  }
+
+  start = now_in_ns();
+  for(worker = 0; worker < configuration.number_of_workers; worker++)
+  {
+    arguments[worker].configuration = &configuration;
+    arguments[worker].result = &results[worker];
+    arguments[worker].seed = worker + 1;
+
+    if(configuration.use_processes)
+    {
+      pid_t pid = fork();
+      if(pid == 0)
+      {
+        run_worker(&arguments[worker]);
+        _exit(0);
+      }
+      if(pid < 0)
+      {
+        perror("Failed to fork a worker");
+        return errno;
+      }
+    }
+    else if(pthread_create(&threads[worker], NULL, run_worker, &arguments[worker]) != 0)
+    {
+      perror("Failed to start a worker thread");
+      return errno;
+    }
+  }
+
+  for(worker = 0; worker < configuration.number_of_workers; worker++)
+  {
+    if(configuration.use_processes)
+    {
+      wait(NULL);
+    }
+    else
+    {
+      pthread_join(threads[worker], NULL);
+    }
+  }
+
+  print_report(stdout, &configuration, results, (now_in_ns() - start) / 1e9);
+
+  munmap(results, configuration.number_of_workers * sizeof(worker_result_t));
+  free(arguments);
+  free(threads);
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
 {
   int ret, file_descriptor;
   char choice;
@@ -23,10 +517,20 @@ int main(void)
       TESTCHAR_NONE
     };
 
+  if(argc > 1)
+  {
+    if(!strcmp(argv[1], "-b"))
+    {
+      return run_benchmark(argc, argv);
+    }
+    print_usage(argv[0]);
+    return 1;
+  }
+
   printf("Starting device test code example...\n");
 
   // Open the device driver with read/write access
-  file_descriptor = open("/dev/testchar", O_RDWR);
+  file_descriptor = open(DEVICE_PATH, O_RDWR);
   if(file_descriptor < 0)
   {
     perror("Failed to open the device...");
@@ -76,7 +580,7 @@ int main(void)
     getchar();
     printf("Reading from the device...\n");
 
-    ret = read(file_descriptor, receive, BUFFER_LENGTH);
+    ret = read(file_descriptor, receive, BUFFER_LENGTH - 1);
     if(ret < 0)
     {
       perror("Failed to read the message from the device.");
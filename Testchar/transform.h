@@ -0,0 +1,200 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+/**
+ * Case conversion kernels shared by the testchar driver and the user space
+ * benchmark. Each transform comes in two flavours:
+ *
+ *  - a bytewise reference loop, identical to what the driver always did
+ *  - a SWAR ("SIMD within a register") version that converts 8 bytes per
+ *    step with plain 64-bit integer arithmetic, so it is safe in the kernel
+ *    (no FPU/vector state) and needs no special instructions
+ *
+ * The SWAR path only handles words where every byte is 7-bit ASCII. Words
+ * with a byte >= 0x80 go through the reference loop, so the result always
+ * matches tolower()/toupper() of the environment it is built for (the kernel
+ * ctype table also converts Latin-1 letters).
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ctype.h>
+#include <asm/unaligned.h>
+
+typedef u64 transform_word_t;
+
+#define transform_load(pointer)         get_unaligned_le64(pointer)
+#define transform_store(pointer, value) put_unaligned_le64(value, pointer)
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+
+typedef uint64_t transform_word_t;
+
+/**
+ * Loads 8 bytes as a little endian word, so byte i of the buffer is always
+ * bits 8*i..8*i+7 no matter the host byte order.
+ */
+static inline transform_word_t transform_load(const void *pointer)
+{
+  transform_word_t value;
+  memcpy(&value, pointer, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  value = __builtin_bswap64(value);
+#endif
+  return value;
+}
+
+static inline void transform_store(void *pointer, transform_word_t value)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  value = __builtin_bswap64(value);
+#endif
+  memcpy(pointer, &value, sizeof(value));
+}
+#endif
+
+#define TRANSFORM_WORD_SIZE 8
+#define SWAR_ONES           0x0101010101010101ULL
+#define SWAR_HIGH_BITS      0x8080808080808080ULL
+#define SWAR_LOW_BITS       0x7f7f7f7f7f7f7f7fULL
+#define SWAR_REPEAT(byte)   (SWAR_ONES * (unsigned char)(byte))
+#define SWAR_CASE_BIT_SHIFT 2   ///< 0x80 >> 2 == 0x20, the ASCII case bit
+
+/**
+ * Bytewise reference loops.
+ */
+static inline void transform_lower_bytewise(const char *original, char *modified, size_t size)
+{
+  size_t i;
+  for(i = 0; i < size; i++)
+  {
+    modified[i] = tolower((unsigned char)original[i]);
+  }
+}
+
+static inline void transform_upper_bytewise(const char *original, char *modified, size_t size)
+{
+  size_t i;
+  for(i = 0; i < size; i++)
+  {
+    modified[i] = toupper((unsigned char)original[i]);
+  }
+}
+
+/**
+ * Capitalizes the first byte and every byte that follows a space.
+ * previous is the byte before original[0], pass ' ' at the start of a message.
+ */
+static inline void transform_caps_bytewise(const char *original, char *modified, size_t size, char previous)
+{
+  size_t i;
+  for(i = 0; i < size; i++)
+  {
+    char current = original[i];
+
+    if(previous == ' ')
+    {
+      modified[i] = toupper((unsigned char)current);
+    }
+    else
+    {
+      modified[i] = current;
+    }
+    previous = current;
+  }
+}
+
+/**
+ * Returns 0x80 in every byte of word that lies in [low, high].
+ * Every byte of word must be below 0x80, which keeps the additions from
+ * carrying into the neighbouring byte.
+ */
+static inline transform_word_t swar_in_range(transform_word_t word, unsigned char low, unsigned char high)
+{
+  transform_word_t at_least_low = word + SWAR_REPEAT(0x80 - low);
+  transform_word_t above_high = word + SWAR_REPEAT(0x7f - high);
+
+  return at_least_low & ~above_high & SWAR_HIGH_BITS;
+}
+
+/**
+ * Returns 0x80 in every byte of word that equals byte. Exact for any input.
+ */
+static inline transform_word_t swar_equal(transform_word_t word, unsigned char byte)
+{
+  transform_word_t difference = word ^ SWAR_REPEAT(byte);
+
+  return ~(((difference & SWAR_LOW_BITS) + SWAR_LOW_BITS) | difference) & SWAR_HIGH_BITS;
+}
+
+static inline void transform_lower(const char *original, char *modified, size_t size)
+{
+  size_t i;
+  for(i = 0; i + TRANSFORM_WORD_SIZE <= size; i += TRANSFORM_WORD_SIZE)
+  {
+    transform_word_t word = transform_load(original + i);
+
+    if(word & SWAR_HIGH_BITS)
+    {
+      transform_lower_bytewise(original + i, modified + i, TRANSFORM_WORD_SIZE);
+      continue;
+    }
+    word |= swar_in_range(word, 'A', 'Z') >> SWAR_CASE_BIT_SHIFT;
+    transform_store(modified + i, word);
+  }
+  transform_lower_bytewise(original + i, modified + i, size - i);
+}
+
+static inline void transform_upper(const char *original, char *modified, size_t size)
+{
+  size_t i;
+  for(i = 0; i + TRANSFORM_WORD_SIZE <= size; i += TRANSFORM_WORD_SIZE)
+  {
+    transform_word_t word = transform_load(original + i);
+
+    if(word & SWAR_HIGH_BITS)
+    {
+      transform_upper_bytewise(original + i, modified + i, TRANSFORM_WORD_SIZE);
+      continue;
+    }
+    word &= ~(swar_in_range(word, 'a', 'z') >> SWAR_CASE_BIT_SHIFT);
+    transform_store(modified + i, word);
+  }
+  transform_upper_bytewise(original + i, modified + i, size - i);
+}
+
+/**
+ * SWAR version of the caps transform. The "previous byte" of every lane is
+ * built by shifting the word up one byte and feeding in the last byte of
+ * the previous word, so there is no per-byte branch on original[i - 1].
+ */
+static inline void transform_caps(const char *original, char *modified, size_t size)
+{
+  size_t i;
+  unsigned char previous = ' ';
+
+  for(i = 0; i + TRANSFORM_WORD_SIZE <= size; i += TRANSFORM_WORD_SIZE)
+  {
+    transform_word_t word = transform_load(original + i);
+    transform_word_t shifted = (word << 8) | previous;
+    unsigned char last = word >> 56;   // read before modified may overwrite original
+
+    if(word & SWAR_HIGH_BITS)
+    {
+      transform_caps_bytewise(original + i, modified + i, TRANSFORM_WORD_SIZE, previous);
+    }
+    else
+    {
+      transform_word_t after_space = swar_equal(shifted, ' ');
+      word &= ~((swar_in_range(word, 'a', 'z') & after_space) >> SWAR_CASE_BIT_SHIFT);
+      transform_store(modified + i, word);
+    }
+    previous = last;
+  }
+  transform_caps_bytewise(original + i, modified + i, size - i, previous);
+}
+
+#endif
@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "transform.h"
+#include "transform_simd.h"
+#include "pipeline.h"
+#include "transform_vectors.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLE_UNIT "cycle"
+#else
+#define CYCLE_UNIT "ns"
+#endif
+
+#define RANDOM_CHECK_LENGTH 300          ///< Longest random input used by the cross check
+#define BENCH_BYTES_PER_SIZE (64 << 20)  ///< Every size converts about this many bytes
+
+enum
+{
+  Lower,
+  Upper,
+  Caps,
+  NumberOfTransforms
+};
+
+typedef void (*transform_function_t)(const char *, char *, size_t);
+
+typedef struct transform_implementation_t
+{
+  const char *name;
+  transform_function_t transforms[NumberOfTransforms];
+} transform_implementation_t;
+
+static const char *transform_names[NumberOfTransforms] = { "lower", "upper", "caps" };
+
+/// One step pipelines, the same conversions through the compiled tables
+static struct pipeline_program table_programs[NumberOfTransforms];
+
+static void caps_bytewise(const char *original, char *modified, size_t size)
+{
+  transform_caps_bytewise(original, modified, size, ' ');
+}
+
+static void lower_swar(const char *original, char *modified, size_t size)
+{
+  transform_lower(original, modified, size);
+}
+
+static void upper_swar(const char *original, char *modified, size_t size)
+{
+  transform_upper(original, modified, size);
+}
+
+static void caps_swar(const char *original, char *modified, size_t size)
+{
+  transform_caps(original, modified, size);
+}
+
+static void lower_bytewise(const char *original, char *modified, size_t size)
+{
+  transform_lower_bytewise(original, modified, size);
+}
+
+static void upper_bytewise(const char *original, char *modified, size_t size)
+{
+  transform_upper_bytewise(original, modified, size);
+}
+
+static void lower_simd(const char *original, char *modified, size_t size)
+{
+  transform_lower_simd(original, modified, size);
+}
+
+static void upper_simd(const char *original, char *modified, size_t size)
+{
+  transform_upper_simd(original, modified, size);
+}
+
+static void caps_simd(const char *original, char *modified, size_t size)
+{
+  transform_caps_simd(original, modified, size);
+}
+
+static void lower_table(const char *original, char *modified, size_t size)
+{
+  pipeline_run(&table_programs[Lower], original, modified, size);
+}
+
+static void upper_table(const char *original, char *modified, size_t size)
+{
+  pipeline_run(&table_programs[Upper], original, modified, size);
+}
+
+static void caps_table(const char *original, char *modified, size_t size)
+{
+  pipeline_run(&table_programs[Caps], original, modified, size);
+}
+
+static const transform_implementation_t implementations[] =
+{
+  { "bytewise", { lower_bytewise, upper_bytewise, caps_bytewise } },
+  { "swar",     { lower_swar,     upper_swar,     caps_swar } },
+  { "simd",     { lower_simd,     upper_simd,     caps_simd } },
+  { "table",    { lower_table,    upper_table,    caps_table } }
+};
+
+#define NUMBER_OF_IMPLEMENTATIONS (sizeof(implementations) / sizeof(implementations[0]))
+
+static unsigned long long read_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+static void compile_table_programs(void)
+{
+  static const unsigned char step_types[NumberOfTransforms] =
+  {
+    TESTCHAR_STEP_LOWER, TESTCHAR_STEP_UPPER, TESTCHAR_STEP_CAPS
+  };
+  struct testchar_pipeline pipeline;
+  int i;
+
+  memset(&pipeline, 0, sizeof(pipeline));
+  pipeline.count = 1;
+  for(i = 0; i < NumberOfTransforms; i++)
+  {
+    pipeline.steps[0].type = step_types[i];
+    pipeline_compile(&pipeline, &table_programs[i]);
+  }
+}
+
+/**
+ * Checks pipelines that chain several steps against running the steps one
+ * after the other with the reference loops.
+ */
+static int check_pipelines(void)
+{
+  static const char input[] = "hello World, the 2nd  caps\ttest:\xe9t\xe9 ZEBRA!";
+  char expected[sizeof(input)], output[sizeof(input)];
+  size_t size = sizeof(input) - 1;
+  struct pipeline_program program;
+  struct testchar_pipeline pipeline;
+  int failures = 0;
+  size_t i;
+
+  // rot13, caps, replace digits and punctuation with '_', caps again
+  memset(&pipeline, 0, sizeof(pipeline));
+  pipeline.count = 4;
+  pipeline.steps[0].type = TESTCHAR_STEP_ROT13;
+  pipeline.steps[1].type = TESTCHAR_STEP_CAPS;
+  pipeline.steps[2].type = TESTCHAR_STEP_REPLACE;
+  pipeline.steps[2].classes = TESTCHAR_CLASS_DIGIT | TESTCHAR_CLASS_PUNCT;
+  pipeline.steps[2].replacement = ' ';
+  pipeline.steps[3].type = TESTCHAR_STEP_CAPS;
+
+  if(pipeline_compile(&pipeline, &program) != 0 || program.number_of_states != 4)
+  {
+    fprintf(stderr, "[-] ERROR: The pipeline did not compile\n");
+    return 1;
+  }
+
+  memcpy(expected, input, size);
+  for(i = 0; i < size; i++)
+  {
+    expected[i] = pipeline_map(&pipeline.steps[0], expected[i]);
+  }
+  transform_caps_bytewise(expected, expected, size, ' ');
+  for(i = 0; i < size; i++)
+  {
+    expected[i] = pipeline_map(&pipeline.steps[2], expected[i]);
+  }
+  transform_caps_bytewise(expected, expected, size, ' ');
+
+  pipeline_run(&program, input, output, size);
+  if(memcmp(output, expected, size) != 0)
+  {
+    fprintf(stderr, "[-] ERROR: The pipeline gave [%.*s] instead of [%.*s]\n",
+            (int)size, output, (int)size, expected);
+    failures++;
+  }
+
+  // More caps steps than the driver allows must be rejected
+  pipeline.steps[0].type = TESTCHAR_STEP_CAPS;
+  if(pipeline_compile(&pipeline, &program) != -EINVAL)
+  {
+    fprintf(stderr, "[-] ERROR: A pipeline with three caps steps compiled\n");
+    failures++;
+  }
+
+  return failures;
+}
+
+/**
+ * Runs one transform on input and compares it to expected.
+ * The output is surrounded by guard bytes to catch writes past the end.
+ */
+static int check_one(const transform_implementation_t *implementation, int transform,
+                     const char *input, size_t size, const char *expected)
+{
+  char output[RANDOM_CHECK_LENGTH + 2];
+
+  memset(output, '#', sizeof(output));
+  implementation->transforms[transform](input, output + 1, size);
+
+  if(memcmp(output + 1, expected, size) != 0 || output[0] != '#' || output[size + 1] != '#')
+  {
+    fprintf(stderr, "[-] ERROR: %s %s failed on a %zu byte input [%.*s]\n",
+            implementation->name, transform_names[transform], size, (int)size, input);
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * Checks every implementation against the known answer table, then against
+ * the bytewise loops on random inputs of every length and start alignment.
+ */
+static int check_implementations(void)
+{
+  static const char alphabet[] = "aAzZ@[`{ 09\xa9\x80";
+  char input[RANDOM_CHECK_LENGTH + 8];
+  char expected[RANDOM_CHECK_LENGTH];
+  int failures = 0;
+  size_t i, j, k, size, alignment;
+
+  for(i = 0; i < NUMBER_OF_IMPLEMENTATIONS; i++)
+  {
+    const transform_implementation_t *implementation = &implementations[i];
+
+    for(j = 0; j < NUMBER_OF_TRANSFORM_VECTORS; j++)
+    {
+      const transform_vector_t *vector = &transform_vectors[j];
+      size = strlen(vector->input);
+
+      failures += check_one(implementation, Lower, vector->input, size, vector->lower);
+      failures += check_one(implementation, Upper, vector->input, size, vector->upper);
+      failures += check_one(implementation, Caps, vector->input, size, vector->caps);
+    }
+  }
+
+  srand(1);
+  for(size = 0; size <= RANDOM_CHECK_LENGTH; size++)
+  {
+    for(alignment = 0; alignment < 8; alignment++)
+    {
+      char *original = input + alignment;
+
+      for(j = 0; j < size; j++)
+      {
+        original[j] = alphabet[rand() % (sizeof(alphabet) - 1)];
+      }
+
+      for(k = 0; k < NumberOfTransforms; k++)
+      {
+        // implementations[0] is the bytewise reference
+        implementations[0].transforms[k](original, expected, size);
+
+        for(i = 1; i < NUMBER_OF_IMPLEMENTATIONS; i++)
+        {
+          failures += check_one(&implementations[i], k, original, size, expected);
+        }
+      }
+    }
+  }
+
+  return failures;
+}
+
+/**
+ * Returns how many bytes one transform converts per clock unit on a
+ * buffer of the given size.
+ */
+static double measure(transform_function_t transform, const char *input, char *output, size_t size)
+{
+  size_t iterations = BENCH_BYTES_PER_SIZE / size;
+  unsigned long long start, stop;
+  size_t i;
+
+  // Warm up the caches and the branch predictors
+  transform(input, output, size);
+
+  start = read_clock();
+  for(i = 0; i < iterations; i++)
+  {
+    transform(input, output, size);
+    __asm__ __volatile__("" : : "r"(output) : "memory");
+  }
+  stop = read_clock();
+
+  return (double)(iterations * size) / (double)(stop - start);
+}
+
+int main(void)
+{
+  static const size_t sizes[] = { 16, 64, 256, 1024, 4096, 65536, 1 << 20 };
+  size_t largest = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+  char *input, *output;
+  int failures;
+  size_t i, j, k;
+
+  compile_table_programs();
+
+  failures = check_implementations() + check_pipelines();
+  if(failures > 0)
+  {
+    fprintf(stderr, "[-] ERROR: %d transform checks failed\n", failures);
+    return 1;
+  }
+  printf("[+] All implementations and pipelines match the %zu test vectors and the bytewise loops\n",
+         NUMBER_OF_TRANSFORM_VECTORS);
+
+  input = malloc(largest);
+  output = malloc(largest);
+  if(input == NULL || output == NULL)
+  {
+    fprintf(stderr, "[-] ERROR: Could not allocate the benchmark buffers\n");
+    return 1;
+  }
+
+  // Mostly lowercase words separated by spaces, like the messages the driver sees
+  for(i = 0; i < largest; i++)
+  {
+    input[i] = (rand() % 6 == 0) ? ' ' : 'a' + rand() % 26;
+  }
+
+  printf("%-9s %-9s", "transform", "size");
+  for(k = 0; k < NUMBER_OF_IMPLEMENTATIONS; k++)
+  {
+    printf(" %10s", implementations[k].name);
+  }
+  printf("   (bytes/%s)\n", CYCLE_UNIT);
+
+  for(j = 0; j < NumberOfTransforms; j++)
+  {
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+      printf("%-9s %-9zu", transform_names[j], sizes[i]);
+      for(k = 0; k < NUMBER_OF_IMPLEMENTATIONS; k++)
+      {
+        printf(" %10.3f", measure(implementations[k].transforms[j], input, output, sizes[i]));
+      }
+      printf("\n");
+    }
+  }
+
+  free(input);
+  free(output);
+
+  return 0;
+}
@@ -0,0 +1,97 @@
+#ifndef TRANSFORM_SIMD_H
+#define TRANSFORM_SIMD_H
+
+/**
+ * User space only SSE2 versions of the testchar transforms, 16 bytes per
+ * step. The kernel cannot touch vector registers without kernel_fpu_begin(),
+ * which is why the driver uses the SWAR kernels from transform.h instead.
+ *
+ * Signed byte compares put every byte >= 0x80 below 'A', so high bytes are
+ * never converted, same as tolower()/toupper() in the C locale.
+ * On targets without SSE2 these fall back to the SWAR kernels.
+ */
+
+#include "transform.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+#define TRANSFORM_SIMD_SIZE 16
+
+/**
+ * Returns 0xff in every byte of vector that lies in [low, high].
+ */
+static inline __m128i simd_in_range(__m128i vector, char low, char high)
+{
+  __m128i at_least_low = _mm_cmpgt_epi8(vector, _mm_set1_epi8(low - 1));
+  __m128i at_most_high = _mm_cmplt_epi8(vector, _mm_set1_epi8(high + 1));
+
+  return _mm_and_si128(at_least_low, at_most_high);
+}
+
+static inline void transform_lower_simd(const char *original, char *modified, size_t size)
+{
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  size_t i;
+
+  for(i = 0; i + TRANSFORM_SIMD_SIZE <= size; i += TRANSFORM_SIMD_SIZE)
+  {
+    __m128i vector = _mm_loadu_si128((const __m128i *)(original + i));
+    __m128i mask = simd_in_range(vector, 'A', 'Z');
+
+    vector = _mm_or_si128(vector, _mm_and_si128(mask, case_bit));
+    _mm_storeu_si128((__m128i *)(modified + i), vector);
+  }
+  transform_lower(original + i, modified + i, size - i);
+}
+
+static inline void transform_upper_simd(const char *original, char *modified, size_t size)
+{
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  size_t i;
+
+  for(i = 0; i + TRANSFORM_SIMD_SIZE <= size; i += TRANSFORM_SIMD_SIZE)
+  {
+    __m128i vector = _mm_loadu_si128((const __m128i *)(original + i));
+    __m128i mask = simd_in_range(vector, 'a', 'z');
+
+    vector = _mm_andnot_si128(_mm_and_si128(mask, case_bit), vector);
+    _mm_storeu_si128((__m128i *)(modified + i), vector);
+  }
+  transform_upper(original + i, modified + i, size - i);
+}
+
+/**
+ * The previous bytes come from an unaligned load one byte back, so the
+ * first byte is done on its own with ' ' as its predecessor.
+ */
+static inline void transform_caps_simd(const char *original, char *modified, size_t size)
+{
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  const __m128i space = _mm_set1_epi8(' ');
+  size_t i;
+
+  if(size == 0)
+  {
+    return;
+  }
+  transform_caps_bytewise(original, modified, 1, ' ');
+
+  for(i = 1; i + TRANSFORM_SIMD_SIZE <= size; i += TRANSFORM_SIMD_SIZE)
+  {
+    __m128i vector = _mm_loadu_si128((const __m128i *)(original + i));
+    __m128i previous = _mm_loadu_si128((const __m128i *)(original + i - 1));
+    __m128i mask = _mm_and_si128(simd_in_range(vector, 'a', 'z'), _mm_cmpeq_epi8(previous, space));
+
+    vector = _mm_andnot_si128(_mm_and_si128(mask, case_bit), vector);
+    _mm_storeu_si128((__m128i *)(modified + i), vector);
+  }
+  transform_caps_bytewise(original + i, modified + i, size - i, original[i - 1]);
+}
+#else
+#define transform_lower_simd transform_lower
+#define transform_upper_simd transform_upper
+#define transform_caps_simd  transform_caps
+#endif
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef TRANSFORM_VECTORS_H
+#define TRANSFORM_VECTORS_H
+
+/**
+ * Known answers for the testchar transforms. Every implementation in
+ * transform.h and transform_simd.h is checked against this table before it
+ * is benchmarked. The inputs cross the 8 and 16 byte boundaries the SWAR and
+ * SIMD kernels work in, put spaces right before a word boundary, and use the
+ * bytes next to the letter ranges ('@', '[', '`', '{'). High bytes are kept to
+ * 0x80-0xbf, which have no case in either the kernel or the C locale.
+ */
+typedef struct transform_vector_t
+{
+  const char *input;
+  const char *lower;
+  const char *upper;
+  const char *caps;
+} transform_vector_t;
+
+static const transform_vector_t transform_vectors[] =
+{
+  { "",
+    "",
+    "",
+    "" },
+  { "a",
+    "a",
+    "A",
+    "A" },
+  { "Z",
+    "z",
+    "Z",
+    "Z" },
+  { "hello world",
+    "hello world",
+    "HELLO WORLD",
+    "Hello World" },
+  { "Hello World",
+    "hello world",
+    "HELLO WORLD",
+    "Hello World" },
+  { "HELLO WORLD",
+    "hello world",
+    "HELLO WORLD",
+    "HELLO WORLD" },
+  { "the quick brown fox jumps over the lazy dog",
+    "the quick brown fox jumps over the lazy dog",
+    "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG",
+    "The Quick Brown Fox Jumps Over The Lazy Dog" },
+  { "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG",
+    "the quick brown fox jumps over the lazy dog",
+    "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG",
+    "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG" },
+  { "1234567 abcdefg",
+    "1234567 abcdefg",
+    "1234567 ABCDEFG",
+    "1234567 Abcdefg" },
+  { "abcdefg hijklmnopqrstuv wxyz",
+    "abcdefg hijklmnopqrstuv wxyz",
+    "ABCDEFG HIJKLMNOPQRSTUV WXYZ",
+    "Abcdefg Hijklmnopqrstuv Wxyz" },
+  { "       x",
+    "       x",
+    "       X",
+    "       X" },
+  { "        y",
+    "        y",
+    "        Y",
+    "        Y" },
+  { "@AZ[`az{ @az[`AZ{",
+    "@az[`az{ @az[`az{",
+    "@AZ[`AZ{ @AZ[`AZ{",
+    "@AZ[`az{ @az[`AZ{" },
+  { "  double  spaced  words  ",
+    "  double  spaced  words  ",
+    "  DOUBLE  SPACED  WORDS  ",
+    "  Double  Spaced  Words  " },
+  { "tab\tand\nnewline are not spaces",
+    "tab\tand\nnewline are not spaces",
+    "TAB\tAND\nNEWLINE ARE NOT SPACES",
+    "Tab\tand\nnewline Are Not Spaces" },
+  { "mixed \xa9 bytes \xa9high bits stay put",
+    "mixed \xa9 bytes \xa9high bits stay put",
+    "MIXED \xa9 BYTES \xa9HIGH BITS STAY PUT",
+    "Mixed \xa9 Bytes \xa9high Bits Stay Put" },
+  { "\x80\x9f\xa0\xbf abc \x80" "abc",
+    "\x80\x9f\xa0\xbf abc \x80" "abc",
+    "\x80\x9f\xa0\xbf ABC \x80" "ABC",
+    "\x80\x9f\xa0\xbf Abc \x80" "abc" },
+  { "exactly sixteen!",
+    "exactly sixteen!",
+    "EXACTLY SIXTEEN!",
+    "Exactly Sixteen!" },
+  { "seventeen bytes!!",
+    "seventeen bytes!!",
+    "SEVENTEEN BYTES!!",
+    "Seventeen Bytes!!" },
+  { "a b c d e f g h i j k l m n o p q r s t u v w x y z",
+    "a b c d e f g h i j k l m n o p q r s t u v w x y z",
+    "A B C D E F G H I J K L M N O P Q R S T U V W X Y Z",
+    "A B C D E F G H I J K L M N O P Q R S T U V W X Y Z" },
+};
+
+#define NUMBER_OF_TRANSFORM_VECTORS (sizeof(transform_vectors) / sizeof(transform_vectors[0]))
+
+#endif
@@ -0,0 +1,152 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "AsyncWriter.h"
+
+/**
+ * Writes everything between tail and head to the file, at most two
+ * write() calls per wrap of the ring.
+ */
+static void drain(async_writer_t *writer)
+{
+  size_t head = atomic_load_explicit(&writer->head, memory_order_acquire);
+  size_t tail = atomic_load_explicit(&writer->tail, memory_order_relaxed);
+
+  while(tail != head)
+  {
+    size_t offset = tail & (writer->capacity - 1);
+    size_t length = head - tail;
+    ssize_t written;
+
+    if(length > writer->capacity - offset)
+    {
+      length = writer->capacity - offset;
+    }
+
+    written = writer->writeError ? (ssize_t)length : write(writer->fileDescriptor, writer->ring + offset, length);
+    if(written < 0)
+    {
+      if(errno == EINTR)
+      {
+        continue;
+      }
+      // Keep consuming, so the sampling thread still has room
+      writer->writeError = errno;
+      written = length;
+    }
+
+    tail += written;
+    atomic_store_explicit(&writer->tail, tail, memory_order_release);
+  }
+}
+
+static void *run_writer(void *argument)
+{
+  async_writer_t *writer = argument;
+  struct timespec wakeup = { 0, WriterWakeupInMilliSec * 1000000L };
+
+  // Sleeping between batches, not waiting on a lock, keeps the sampling thread free of system calls
+  while(!atomic_load(&writer->closing))
+  {
+    drain(writer);
+    nanosleep(&wakeup, NULL);
+  }
+  drain(writer);
+
+  return NULL;
+}
+
+/**
+ * Called by stdio on the sampling thread whenever its buffer fills up.
+ * Copies into the ring or drops the data, but never waits.
+ */
+static ssize_t stream_write(void *cookie, const char *buffer, size_t size)
+{
+  async_writer_t *writer = cookie;
+  size_t head = atomic_load_explicit(&writer->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&writer->tail, memory_order_acquire);
+  size_t offset = head & (writer->capacity - 1);
+  size_t first;
+
+  if(size > writer->capacity - (head - tail))
+  {
+    writer->droppedBytes += size;
+    writer->droppedWrites++;
+    return size;
+  }
+
+  first = size < writer->capacity - offset ? size : writer->capacity - offset;
+  memcpy(writer->ring + offset, buffer, first);
+  memcpy(writer->ring, buffer + first, size - first);
+  atomic_store_explicit(&writer->head, head + size, memory_order_release);
+
+  return size;
+}
+
+/**
+ * fclose() of the stream stops the writer thread once the ring is empty
+ * and closes the file. droppedBytes and writeError stay readable.
+ */
+static int stream_close(void *cookie)
+{
+  async_writer_t *writer = cookie;
+
+  atomic_store(&writer->closing, 1);
+  pthread_join(writer->thread, NULL);
+  free(writer->ring);
+
+  if(close(writer->fileDescriptor) < 0 && writer->writeError == 0)
+  {
+    writer->writeError = errno;
+  }
+
+  return writer->writeError ? -1 : 0;
+}
+
+/**
+ * Starts a writer thread for fileDescriptor and returns a stream that feeds
+ * it, so the capture code keeps using fprintf() and fwrite(). capacity is
+ * rounded up to a power of two.
+ * Returns NULL with errno set on failure.
+ */
+FILE *async_writer_open(async_writer_t *writer, int fileDescriptor, size_t capacity)
+{
+  cookie_io_functions_t functions = { .write = stream_write, .close = stream_close };
+  FILE *stream;
+  int error;
+
+  memset(writer, 0, sizeof(*writer));
+  writer->fileDescriptor = fileDescriptor;
+  for(writer->capacity = 4096; writer->capacity < capacity; writer->capacity *= 2)
+  {
+  }
+
+  writer->ring = malloc(writer->capacity);
+  if(writer->ring == NULL)
+  {
+    return NULL;
+  }
+  // Fault the ring in now rather than on the sampling thread
+  memset(writer->ring, 0, writer->capacity);
+
+  error = pthread_create(&writer->thread, NULL, run_writer, writer);
+  if(error)
+  {
+    free(writer->ring);
+    errno = error;
+    return NULL;
+  }
+
+  stream = fopencookie(writer, "w", functions);
+  if(stream == NULL)
+  {
+    atomic_store(&writer->closing, 1);
+    pthread_join(writer->thread, NULL);
+    free(writer->ring);
+  }
+
+  return stream;
+}
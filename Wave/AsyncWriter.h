@@ -0,0 +1,41 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+enum
+{
+  DefaultRingSizeInBytes = 8 << 20,   ///< About 4 s of 100 kHz text samples
+  WriterWakeupInMilliSec = 20
+};
+
+/**
+ * Moves file I/O off the sampling thread. The sampling thread only copies
+ * its output into a single producer / single consumer ring, which never
+ * blocks and never makes a system call; a writer thread drains the ring
+ * with large write() calls. If storage falls so far behind that the ring
+ * fills up, the output that does not fit is dropped and counted instead of
+ * delaying the next sample. Every write of the stream is kept or dropped
+ * whole, so output flushed one record at a time loses whole records only.
+ */
+typedef struct async_writer_t
+{
+  int fileDescriptor;
+  char *ring;
+  size_t capacity;                    ///< Power of two
+  _Atomic size_t head;                ///< Bytes ever produced, only written by the sampling thread
+  _Atomic size_t tail;                ///< Bytes ever consumed, only written by the writer thread
+  atomic_int closing;
+  pthread_t thread;
+  uint64_t droppedBytes;              ///< Output lost because the ring was full
+  uint64_t droppedWrites;             ///< Writes of the stream that were lost, counted on the sampling thread
+  int writeError;                     ///< errno of the first failed write, 0 if none
+} async_writer_t;
+
+FILE *async_writer_open(async_writer_t *writer, int fileDescriptor, size_t capacity);
+
+#endif
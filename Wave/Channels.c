@@ -0,0 +1,128 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "EvdevInput.h"
+#include "Channels.h"
+
+/**
+ * Returns the lane keyCode drives so far, or NoLane.
+ */
+static int channels_find_key(const channels_t *channels, int keyCode)
+{
+  for(int lane = 0; lane < channels->numberOfChannels; lane++)
+  {
+    if(channels->keyCodeOfLane[lane] == keyCode)
+    {
+      return lane;
+    }
+  }
+
+  return NoLane;
+}
+
+/**
+ * Parses a comma separated channel list such as "30,48,/sys/class/gpio/gpio60/value".
+ * Channel i is lane i. Numbers are KEY_* codes, anything else is opened as
+ * a sysfs value file. A key code can drive only one lane.
+ * Returns 0, or -1 with errno set, EINVAL for a bad or repeated key code
+ * or a list without any channel, such as "" or ",".
+ */
+int channels_parse(channels_t *channels, const char *text)
+{
+  char *copy = strdup(text);
+  char *saveptr = NULL;
+  char *entry, *end;
+  int lane;
+
+  memset(channels, 0, sizeof(*channels));
+  if(copy == NULL)
+  {
+    return -1;
+  }
+
+  for(entry = strtok_r(copy, ",", &saveptr); entry != NULL; entry = strtok_r(NULL, ",", &saveptr))
+  {
+    if(channels->numberOfChannels == WaveMaximumChannels)
+    {
+      errno = E2BIG;
+      break;
+    }
+    lane = channels->numberOfChannels++;
+    channels->keyCodeOfLane[lane] = NoLane;
+    channels->lineDescriptorOfLane[lane] = -1;
+
+    long keyCode = strtol(entry, &end, 10);
+    if(*end == '\0')
+    {
+      if(keyCode < 0 || keyCode >= KEY_CNT || channels_find_key(channels, keyCode) != NoLane)
+      {
+        errno = EINVAL;
+        break;
+      }
+      channels->keyCodeOfLane[lane] = keyCode;
+      channels->keyLanes |= 1ULL << lane;
+      continue;
+    }
+
+    channels->lineDescriptorOfLane[lane] = open(entry, O_RDONLY | O_CLOEXEC);
+    if(channels->lineDescriptorOfLane[lane] < 0)
+    {
+      break;
+    }
+    channels->lineLanes |= 1ULL << lane;
+  }
+
+  free(copy);
+  if(entry != NULL)
+  {
+    channels_close(channels);
+    return -1;
+  }
+  if(channels->numberOfChannels == 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Samples every line channel. A line reads as 1 unless its file starts
+ * with "0", so GPIO values and LED brightness levels both work.
+ */
+uint64_t channels_read_lines(const channels_t *channels)
+{
+  uint64_t lanes = 0;
+  char value;
+
+  for(int lane = 0; lane < channels->numberOfChannels; lane++)
+  {
+    if(channels->lineDescriptorOfLane[lane] < 0)
+    {
+      continue;
+    }
+    // sysfs attributes are read again from offset 0, without reopening them
+    if(pread(channels->lineDescriptorOfLane[lane], &value, 1, 0) == 1 && value != '0')
+    {
+      lanes |= 1ULL << lane;
+    }
+  }
+
+  return lanes;
+}
+
+void channels_close(channels_t *channels)
+{
+  for(int lane = 0; lane < channels->numberOfChannels; lane++)
+  {
+    if(channels->lineDescriptorOfLane[lane] >= 0)
+    {
+      close(channels->lineDescriptorOfLane[lane]);
+      channels->lineDescriptorOfLane[lane] = -1;
+    }
+  }
+}
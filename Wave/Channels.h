@@ -0,0 +1,27 @@
+#ifndef CHANNELS_H
+#define CHANNELS_H
+
+#include <stdint.h>
+#include "WaveFormat.h"
+
+/**
+ * What drives every lane of a multi-channel capture. A channel is either a
+ * KEY_* code read through the evdev device, or the path of a sysfs value
+ * file such as /sys/class/gpio/gpio60/value or the brightness of a LED,
+ * read at every sample. All of them share the one sampler timer, so every
+ * sample holds the lanes at the same instant.
+ */
+typedef struct channels_t
+{
+  int numberOfChannels;
+  int keyCodeOfLane[WaveMaximumChannels];         ///< NoLane for line channels
+  int lineDescriptorOfLane[WaveMaximumChannels];  ///< -1 for key channels
+  uint64_t keyLanes;
+  uint64_t lineLanes;
+} channels_t;
+
+int channels_parse(channels_t *channels, const char *text);
+uint64_t channels_read_lines(const channels_t *channels);
+void channels_close(channels_t *channels);
+
+#endif
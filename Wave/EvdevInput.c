@@ -0,0 +1,188 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "EvdevInput.h"
+
+enum
+{
+  EventsPerRead = 64
+};
+
+static void set_key(evdev_input_t *input, int code, int down)
+{
+  int lane = input->laneOfKey[code];
+  uint8_t mask = 1 << (code % 8);
+
+  if(down && !(input->keysDown[code / 8] & mask))
+  {
+    input->keysDown[code / 8] |= mask;
+    input->keysDownInLane[lane]++;
+    input->lanesDown |= 1ULL << lane;
+    input->lanesPressedSinceLastSample |= 1ULL << lane;
+  }
+  else if(!down && (input->keysDown[code / 8] & mask))
+  {
+    input->keysDown[code / 8] &= ~mask;
+    if(--input->keysDownInLane[lane] == 0)
+    {
+      input->lanesDown &= ~(1ULL << lane);
+    }
+  }
+}
+
+/**
+ * Rebuilds the pressed keys from the state the kernel keeps, after opening
+ * the device or after events were dropped.
+ */
+static void synchronize_keys(evdev_input_t *input)
+{
+  uint8_t keysDown[sizeof(input->keysDown)] = { 0 };
+
+  memset(input->keysDown, 0, sizeof(input->keysDown));
+  memset(input->keysDownInLane, 0, sizeof(input->keysDownInLane));
+  input->lanesDown = 0;
+
+  // On failure every key counts as released
+  ioctl(input->fileDescriptor, EVIOCGKEY(sizeof(keysDown)), keysDown);
+
+  for(int code = 0; code < KEY_CNT; code++)
+  {
+    if(input->laneOfKey[code] != NoLane && (keysDown[code / 8] & (1 << (code % 8))))
+    {
+      set_key(input, code, 1);
+    }
+  }
+}
+
+/**
+ * Opens an evdev device and switches its timestamps to CLOCK_MONOTONIC.
+ * keyCodeOfLane holds the KEY_* code from linux/input-event-codes.h that
+ * drives every lane, or NoLane for lanes fed from elsewhere. With no
+ * lanes, any key drives lane 0. A key can drive only one lane.
+ * Returns 0, or -1 with errno set, EINVAL for a key given to two lanes.
+ */
+int evdev_open(evdev_input_t *input, const char *path, const int *keyCodeOfLane, int numberOfLanes)
+{
+  int clockId = CLOCK_MONOTONIC;
+  int version;
+
+  memset(input, 0, sizeof(*input));
+  memset(input->laneOfKey, numberOfLanes > 0 ? NoLane : 0, sizeof(input->laneOfKey));
+  for(int lane = 0; lane < numberOfLanes && lane < 64; lane++)
+  {
+    if(keyCodeOfLane[lane] >= 0 && keyCodeOfLane[lane] < KEY_CNT)
+    {
+      if(input->laneOfKey[keyCodeOfLane[lane]] != NoLane)
+      {
+        errno = EINVAL;
+        return -1;
+      }
+      input->laneOfKey[keyCodeOfLane[lane]] = lane;
+    }
+  }
+
+  input->fileDescriptor = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if(input->fileDescriptor < 0)
+  {
+    return -1;
+  }
+  if(ioctl(input->fileDescriptor, EVIOCGVERSION, &version) < 0 ||
+     ioctl(input->fileDescriptor, EVIOCSCLOCKID, &clockId) < 0)
+  {
+    close(input->fileDescriptor);
+    return -1;
+  }
+
+  synchronize_keys(input);
+
+  return 0;
+}
+
+/**
+ * Handles one key event.
+ * Returns 1 if a lane changed.
+ */
+static int handle_key(evdev_input_t *input, int code, int value)
+{
+  uint64_t lanesDown = input->lanesDown;
+
+  // 2 is auto-repeat, which is not a new press
+  if(code < 0 || code >= KEY_CNT || value == 2 || input->laneOfKey[code] == NoLane)
+  {
+    return 0;
+  }
+
+  set_key(input, code, value);
+
+  return lanesDown != input->lanesDown;
+}
+
+/**
+ * Reads every event queued on the device without blocking, and calls
+ * callback for every edge with its kernel timestamp. callback may be NULL.
+ * Returns 0, or -1 with errno set if the device went away.
+ */
+int evdev_poll(evdev_input_t *input, evdev_edge_callback_t callback, void *context)
+{
+  struct input_event events[EventsPerRead];
+  ssize_t length;
+
+  while((length = read(input->fileDescriptor, events, sizeof(events))) > 0)
+  {
+    for(int i = 0; i < length / (ssize_t)sizeof(struct input_event); i++)
+    {
+      struct input_event *event = &events[i];
+
+      if(event->type == EV_SYN && event->code == SYN_DROPPED)
+      {
+        input->dropping = 1;
+      }
+      else if(event->type == EV_SYN && event->code == SYN_REPORT && input->dropping)
+      {
+        uint64_t lanesDown = input->lanesDown;
+
+        input->dropping = 0;
+        synchronize_keys(input);
+        if(callback && lanesDown != input->lanesDown)
+        {
+          callback(context, (uint64_t)event->input_event_sec * 1000000000ULL + event->input_event_usec * 1000ULL,
+                   input->lanesDown);
+        }
+      }
+      else if(event->type == EV_KEY && !input->dropping && handle_key(input, event->code, event->value) && callback)
+      {
+        callback(context, (uint64_t)event->input_event_sec * 1000000000ULL + event->input_event_usec * 1000ULL,
+                 input->lanesDown);
+      }
+    }
+  }
+
+  if(length == 0 || (length < 0 && errno != EAGAIN))
+  {
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Returns the lanes of the current sample: a lane is 1 if one of its keys
+ * is down or was pressed since the previous sample, even if it is already
+ * released.
+ */
+uint64_t evdev_sample(evdev_input_t *input)
+{
+  uint64_t lanes = input->lanesDown | input->lanesPressedSinceLastSample;
+
+  input->lanesPressedSinceLastSample = 0;
+
+  return lanes;
+}
+
+void evdev_close(evdev_input_t *input)
+{
+  close(input->fileDescriptor);
+}
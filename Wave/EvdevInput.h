@@ -0,0 +1,43 @@
+#ifndef EVDEV_INPUT_H
+#define EVDEV_INPUT_H
+
+#include <stdint.h>
+#include <linux/input.h>
+
+enum
+{
+  NoLane = -1
+};
+
+/**
+ * Reads the keys straight from a /dev/input/eventX device instead of a
+ * terminal. Every press and release arrives as an EV_KEY event stamped by
+ * the kernel with CLOCK_MONOTONIC, the clock of the sampler, so the edges
+ * are exact instead of being rounded to the next sample. Auto-repeat
+ * events are ignored.
+ *
+ * Every followed key drives one lane, bit lane of the value; a lane is 1
+ * while any of its keys is down.
+ */
+typedef struct evdev_input_t
+{
+  int fileDescriptor;
+  int8_t laneOfKey[KEY_CNT];                ///< Lane every key drives, or NoLane
+  uint8_t keysDown[KEY_CNT / 8 + 1];        ///< Bitmap of the followed keys held right now
+  uint16_t keysDownInLane[64];
+  uint64_t lanesDown;
+  uint64_t lanesPressedSinceLastSample;     ///< Keeps presses shorter than a period visible
+  int dropping;                             ///< Events were lost, ignore them until the next SYN_REPORT
+} evdev_input_t;
+
+/**
+ * Called for every change of the lanes, with all of them in lanes.
+ */
+typedef void (*evdev_edge_callback_t)(void *context, uint64_t timestampInNanoSec, uint64_t lanes);
+
+int evdev_open(evdev_input_t *input, const char *path, const int *keyCodeOfLane, int numberOfLanes);
+int evdev_poll(evdev_input_t *input, evdev_edge_callback_t callback, void *context);
+uint64_t evdev_sample(evdev_input_t *input);
+void evdev_close(evdev_input_t *input);
+
+#endif
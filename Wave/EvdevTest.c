@@ -0,0 +1,259 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+#include "EvdevInput.h"
+
+/**
+ * Checks EvdevInput against a real evdev device: it creates a virtual
+ * keyboard with uinput, opens its /dev/input/eventX node with evdev_open()
+ * and compares the edges evdev_poll() reports with the keys it typed.
+ * Needs root and the uinput module.
+ */
+
+enum
+{
+  MaximumEdges = 16,
+  NodeWaitMilliSec = 2000   ///< udev creates the device node asynchronously
+};
+
+typedef struct edge_log_t
+{
+  int numberOfEdges;
+  uint64_t timestampInNanoSec[MaximumEdges];
+  uint64_t lanes[MaximumEdges];
+} edge_log_t;
+
+static int failures;
+
+static uint64_t get_time_in_nanosec(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void log_edge(void *context, uint64_t timestampInNanoSec, uint64_t lanes)
+{
+  edge_log_t *log = context;
+
+  if(log->numberOfEdges < MaximumEdges)
+  {
+    log->timestampInNanoSec[log->numberOfEdges] = timestampInNanoSec;
+    log->lanes[log->numberOfEdges] = lanes;
+  }
+  log->numberOfEdges++;
+}
+
+static void emit(int uinputDescriptor, int type, int code, int value)
+{
+  struct input_event event;
+
+  memset(&event, 0, sizeof(event));
+  event.type = type;
+  event.code = code;
+  event.value = value;
+  if(write(uinputDescriptor, &event, sizeof(event)) != sizeof(event))
+  {
+    printf("[-] ERROR: Could not write an event to uinput: %s\n", strerror(errno));
+    failures++;
+  }
+}
+
+/**
+ * Sends one key event followed by its SYN_REPORT.
+ */
+static void type_key(int uinputDescriptor, int code, int value)
+{
+  emit(uinputDescriptor, EV_KEY, code, value);
+  emit(uinputDescriptor, EV_SYN, SYN_REPORT, 0);
+}
+
+static void expect(int condition, const char *what)
+{
+  if(!condition)
+  {
+    printf("[-] ERROR: %s\n", what);
+    failures++;
+  }
+}
+
+/**
+ * Creates a virtual keyboard with KEY_A, KEY_B and KEY_C.
+ * Returns its uinput descriptor, or -1.
+ */
+static int create_keyboard(void)
+{
+  struct uinput_setup setup;
+  int uinputDescriptor = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+
+  if(uinputDescriptor < 0)
+  {
+    return -1;
+  }
+
+  memset(&setup, 0, sizeof(setup));
+  setup.id.bustype = BUS_VIRTUAL;
+  strcpy(setup.name, "Wave EvdevTest keyboard");
+
+  if(ioctl(uinputDescriptor, UI_SET_EVBIT, EV_KEY) < 0 ||
+     ioctl(uinputDescriptor, UI_SET_KEYBIT, KEY_A) < 0 ||
+     ioctl(uinputDescriptor, UI_SET_KEYBIT, KEY_B) < 0 ||
+     ioctl(uinputDescriptor, UI_SET_KEYBIT, KEY_C) < 0 ||
+     ioctl(uinputDescriptor, UI_DEV_SETUP, &setup) < 0 ||
+     ioctl(uinputDescriptor, UI_DEV_CREATE) < 0)
+  {
+    close(uinputDescriptor);
+    return -1;
+  }
+
+  return uinputDescriptor;
+}
+
+/**
+ * Finds the /dev/input/eventX node of the virtual keyboard and waits until
+ * it can be opened.
+ * Returns 0, or -1.
+ */
+static int find_event_node(int uinputDescriptor, char *path, size_t size)
+{
+  char systemName[64], directoryPath[128];
+  struct dirent *entry;
+  DIR *directory;
+
+  if(ioctl(uinputDescriptor, UI_GET_SYSNAME(sizeof(systemName)), systemName) < 0)
+  {
+    return -1;
+  }
+  snprintf(directoryPath, sizeof(directoryPath), "/sys/devices/virtual/input/%s", systemName);
+
+  directory = opendir(directoryPath);
+  if(directory == NULL)
+  {
+    return -1;
+  }
+  path[0] = '\0';
+  while((entry = readdir(directory)) != NULL)
+  {
+    if(strncmp(entry->d_name, "event", 5) == 0 &&
+       (size_t)snprintf(path, size, "/dev/input/%s", entry->d_name) >= size)
+    {
+      path[0] = '\0';
+    }
+  }
+  closedir(directory);
+  if(path[0] == '\0')
+  {
+    return -1;
+  }
+
+  for(int waited = 0; access(path, R_OK) < 0; waited += 10)
+  {
+    if(waited >= NodeWaitMilliSec)
+    {
+      return -1;
+    }
+    usleep(10000);
+  }
+
+  return 0;
+}
+
+int main(void)
+{
+  const int keyCodeOfLane[] = { KEY_A, KEY_B };
+  evdev_input_t input;
+  edge_log_t log;
+  char path[PATH_MAX];
+  uint64_t before, after;
+  int uinputDescriptor;
+
+  uinputDescriptor = create_keyboard();
+  if(uinputDescriptor < 0)
+  {
+    printf("[-] ERROR: Could not create a uinput keyboard (needs root and the uinput module): %s\n", strerror(errno));
+    return 1;
+  }
+  if(find_event_node(uinputDescriptor, path, sizeof(path)) < 0)
+  {
+    printf("[-] ERROR: Could not find the event node of the uinput keyboard.\n");
+    ioctl(uinputDescriptor, UI_DEV_DESTROY);
+    close(uinputDescriptor);
+    return 1;
+  }
+
+  // KEY_A drives lane 0 and KEY_B lane 1, KEY_C is not followed
+  if(evdev_open(&input, path, keyCodeOfLane, 2) < 0)
+  {
+    printf("[-] ERROR: evdev_open(%s) failed: %s\n", path, strerror(errno));
+    ioctl(uinputDescriptor, UI_DEV_DESTROY);
+    close(uinputDescriptor);
+    return 1;
+  }
+  expect(input.lanesDown == 0, "A new keyboard should start with every lane released");
+
+  memset(&log, 0, sizeof(log));
+  before = get_time_in_nanosec();
+  type_key(uinputDescriptor, KEY_A, 1);
+  type_key(uinputDescriptor, KEY_A, 2);   // Auto-repeat, no edge
+  type_key(uinputDescriptor, KEY_C, 1);   // Not followed, no edge
+  type_key(uinputDescriptor, KEY_B, 1);
+  type_key(uinputDescriptor, KEY_A, 0);
+  type_key(uinputDescriptor, KEY_C, 0);
+  type_key(uinputDescriptor, KEY_B, 0);
+  expect(evdev_poll(&input, log_edge, &log) == 0, "evdev_poll() failed");
+  after = get_time_in_nanosec();
+
+  expect(log.numberOfEdges == 4, "Expected 4 edges: A down, B down, A up, B up");
+  if(log.numberOfEdges == 4)
+  {
+    expect(log.lanes[0] == 1 && log.lanes[1] == 3 && log.lanes[2] == 2 && log.lanes[3] == 0,
+           "The edges carry the wrong lanes");
+    for(int i = 0; i < 4; i++)
+    {
+      expect(log.timestampInNanoSec[i] + 1000 >= before && log.timestampInNanoSec[i] <= after,
+             "An edge is not stamped with CLOCK_MONOTONIC");
+      expect(i == 0 || log.timestampInNanoSec[i] >= log.timestampInNanoSec[i - 1], "The edges go back in time");
+    }
+  }
+
+  // Both keys were tapped since the last sample, so both lanes show once
+  expect(evdev_sample(&input) == 3, "A sample should latch the taps since the previous one");
+  expect(evdev_sample(&input) == 0, "The next sample should see the released keys");
+
+  // A key held before the device is opened is picked up from EVIOCGKEY
+  type_key(uinputDescriptor, KEY_B, 1);
+  evdev_close(&input);
+  if(evdev_open(&input, path, keyCodeOfLane, 2) < 0)
+  {
+    printf("[-] ERROR: Reopening %s failed: %s\n", path, strerror(errno));
+    failures++;
+  }
+  else
+  {
+    expect(input.lanesDown == 2, "A key held while opening should be seen as down");
+    evdev_close(&input);
+  }
+  type_key(uinputDescriptor, KEY_B, 0);
+
+  ioctl(uinputDescriptor, UI_DEV_DESTROY);
+  close(uinputDescriptor);
+
+  if(failures > 0)
+  {
+    printf("[-] ERROR: %d evdev checks failed\n", failures);
+    return 1;
+  }
+  printf("[+] EvdevInput reports the uinput key edges with their CLOCK_MONOTONIC timestamps\n");
+
+  return 0;
+}
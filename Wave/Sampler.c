@@ -0,0 +1,74 @@
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "Sampler.h"
+
+/**
+ * Returns the CLOCK_MONOTONIC time, the clock the sampler deadlines use.
+ */
+uint64_t monotonic_time_in_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * Arms a timerfd that expires every 1/sampleRateInHz seconds, starting
+ * one period from now.
+ * Returns 0, or -1 with errno set.
+ */
+int sampler_start(sampler_t *sampler, unsigned int sampleRateInHz)
+{
+  struct itimerspec schedule;
+  uint64_t firstDeadline;
+
+  sampler->periodInNanoSec = 1000000000ULL / sampleRateInHz;
+  sampler->numberOfOverruns = 0;
+
+  sampler->timerDescriptor = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if(sampler->timerDescriptor < 0)
+  {
+    return -1;
+  }
+
+  // Absolute first deadline, the interval keeps every later one on the same grid
+  firstDeadline = monotonic_time_in_ns() + sampler->periodInNanoSec;
+  schedule.it_value.tv_sec = firstDeadline / 1000000000ULL;
+  schedule.it_value.tv_nsec = firstDeadline % 1000000000ULL;
+  schedule.it_interval.tv_sec = sampler->periodInNanoSec / 1000000000ULL;
+  schedule.it_interval.tv_nsec = sampler->periodInNanoSec % 1000000000ULL;
+
+  if(timerfd_settime(sampler->timerDescriptor, TFD_TIMER_ABSTIME, &schedule, NULL) < 0)
+  {
+    close(sampler->timerDescriptor);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Blocks until the next deadline and stores when the sample is taken.
+ * Returns how many deadlines passed since the last call, 1 when none was
+ * missed, or -1 with errno set.
+ */
+int sampler_wait(sampler_t *sampler, uint64_t *timestampInNanoSec)
+{
+  uint64_t expirations;
+
+  if(read(sampler->timerDescriptor, &expirations, sizeof(expirations)) != sizeof(expirations))
+  {
+    return -1;
+  }
+  *timestampInNanoSec = monotonic_time_in_ns();
+
+  sampler->numberOfOverruns += expirations - 1;
+
+  return expirations;
+}
+
+void sampler_stop(sampler_t *sampler)
+{
+  close(sampler->timerDescriptor);
+}
@@ -0,0 +1,30 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdint.h>
+
+enum
+{
+  MinimumSampleRateInHz = 1,
+  MaximumSampleRateInHz = 100000
+};
+
+/**
+ * Wakes the program up at a fixed rate. The deadlines are absolute
+ * CLOCK_MONOTONIC times on one grid laid out when the sampler starts, so
+ * a late wakeup does not push the later ones back and the rate does not
+ * drift the way repeated relative sleeps do.
+ */
+typedef struct sampler_t
+{
+  int timerDescriptor;
+  uint64_t periodInNanoSec;
+  uint64_t numberOfOverruns;  ///< Deadlines that passed while the previous sample was still being taken
+} sampler_t;
+
+int sampler_start(sampler_t *sampler, unsigned int sampleRateInHz);
+int sampler_wait(sampler_t *sampler, uint64_t *timestampInNanoSec);
+void sampler_stop(sampler_t *sampler);
+uint64_t monotonic_time_in_ns();
+
+#endif
@@ -1,19 +1,40 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <termios.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
 #include <sys/time.h>
+#include "Sampler.h"
+#include "WaveFormat.h"
+#include "EvdevInput.h"
+#include "AsyncWriter.h"
+#include "Channels.h"
 
 enum
 {
-  RequiredNumberOfArguments = 3,
-  DelayTimeInSeconds = 1
+  RequiredNumberOfArguments = 2,
+  DefaultSampleRateInHz = 1
 };
 
 static struct termios newTerminalInterface, oldTerminalInterface;
 static fd_set fileDescriptorSet;
 
+/**
+ * Where the edges read from an evdev device go in a binary capture.
+ */
+typedef struct edge_recorder_t
+{
+  wave_writer_t writer;
+  uint64_t startTimestamp;
+  uint64_t periodInNanoSec;
+  uint64_t keyLanes;          ///< Lanes driven by the evdev device, the others come from the samples
+  int started;                ///< Set once the first sample opened the writer
+} edge_recorder_t;
+
 /**
  * Sets the terminal back into canonical mode.
  */ 
@@ -59,47 +80,327 @@ void discard_data()
   tcflush(STDIN_FILENO, TCIFLUSH);
 }
 
+void print_usage(const char *program)
+{
+  printf("[!] Usage: %s [-r <samples per second>] [-b | -w] [-i <device>] [-c <channels> | -k <code>] <output file> <number of samples>\n", program);
+  printf("[!]        %s -x <capture> <vcd file>\n", program);
+  printf("    -r <hz>    sample rate, %d to %d (default %d)\n",
+         MinimumSampleRateInHz, MaximumSampleRateInHz, DefaultSampleRateInHz);
+  printf("    -b         write only the edges, in the binary format of WaveFormat.h\n");
+  printf("    -w         write every sample as a 64 bit word with one bit per channel\n");
+  printf("    -x         convert a binary capture into a Value Change Dump\n");
+  printf("    -i <path>  read the keys from an evdev device such as /dev/input/event0 instead of the terminal\n");
+  printf("    -c <list>  up to %d comma separated channels, one lane each: KEY_* codes read with -i,\n", WaveMaximumChannels);
+  printf("               or sysfs value files such as /sys/class/gpio/gpio60/value (default: any key)\n");
+  printf("    -k <code>  with -i, only follow this KEY_* code, the same as -c <code>\n");
+}
+
+/**
+ * Writes an evdev edge at the tick of its kernel timestamp, so a binary
+ * capture gets the exact press and release instead of the next sample.
+ */
+void record_edge(void *context, uint64_t timestamp, uint64_t lanes)
+{
+  edge_recorder_t *recorder = context;
+  uint64_t tick = 0;
+  uint64_t value = (lanes & recorder->keyLanes) | (recorder->writer.value & ~recorder->keyLanes);
+
+  if(!recorder->started)
+  {
+    return;
+  }
+
+  if(timestamp > recorder->startTimestamp)
+  {
+    tick = (timestamp - recorder->startTimestamp) / recorder->periodInNanoSec;
+  }
+  wave_writer_sample(&recorder->writer, tick, value);
+}
+
+/**
+ * Converts a binary capture into a VCD file for waveform viewers.
+ */
+int export_capture(const char *captureFilename, const char *vcdFilename)
+{
+  FILE *captureFile = fopen(captureFilename, "rb");
+  FILE *vcdFile = fopen(vcdFilename, "w");
+  int status;
+
+  if(captureFile == NULL || vcdFile == NULL)
+  {
+    printf("[-] ERROR: Could not open %s\n", captureFile == NULL ? captureFilename : vcdFilename);
+    return 1;
+  }
+
+  status = wave_export_vcd(captureFile, vcdFile);
+  fclose(captureFile);
+  fclose(vcdFile);
+  if(status < 0)
+  {
+    printf("[-] ERROR: %s is not a valid capture\n", captureFilename);
+    return 1;
+  }
+
+  printf("Done Processing %s\n", vcdFilename);
+
+  return 0;
+}
+
 int main(int argc, char *argv[])
 {
-  if(argc < RequiredNumberOfArguments)
+  int sampleRateInHz = DefaultSampleRateInHz;
+  int writeEdges = 0, writeWords = 0, exportVcd = 0;
+  char *inputPath = NULL, *channelList = NULL, *keyCode = NULL, *end;
+  int option;
+
+  while((option = getopt(argc, argv, "r:bwxi:c:k:")) != -1)
+  {
+    switch(option)
+    {
+      case 'r':
+        sampleRateInHz = atoi(optarg);
+        break;
+      case 'b':
+        writeEdges = 1;
+        break;
+      case 'w':
+        writeWords = 1;
+        break;
+      case 'x':
+        exportVcd = 1;
+        break;
+      case 'i':
+        inputPath = optarg;
+        break;
+      case 'c':
+        channelList = optarg;
+        break;
+      case 'k':
+        keyCode = optarg;
+        break;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if(argc - optind < RequiredNumberOfArguments)
+  {
+    printf("[-] ERROR: Insufficient number of arguments.\n");
+    print_usage(argv[0]);
+    return 1;
+  }
+  if(writeEdges && writeWords)
+  {
+    printf("[-] ERROR: -b and -w are different formats, choose one.\n");
+    return 1;
+  }
+  // -k is the single key channel list it used to be before -c
+  if(keyCode != NULL)
+  {
+    if(channelList != NULL || strtol(keyCode, &end, 10) < 0 || *end != '\0' || end == keyCode)
+    {
+      printf("[-] ERROR: -k takes one KEY_* code and cannot be combined with -c.\n");
+      return 1;
+    }
+    channelList = keyCode;
+  }
+  if(exportVcd)
+  {
+    return export_capture(argv[optind], argv[optind + 1]);
+  }
+  if(sampleRateInHz < MinimumSampleRateInHz || sampleRateInHz > MaximumSampleRateInHz)
+  {
+    printf("[-] ERROR: The sample rate must be between %d and %d Hz.\n", MinimumSampleRateInHz, MaximumSampleRateInHz);
+    return 1;
+  }
+
+  char *outputFilename = argv[optind];
+  int numberOfSamples = atoi(argv[optind + 1]);
+  int outputDescriptor;
+  FILE *outputFile;
+  async_writer_t asyncWriter;
+  channels_t channels = { .numberOfChannels = 0 };
+  sampler_t sampler;
+  evdev_input_t input;
+  edge_recorder_t recorder = { .started = 0 };
+  wave_header_t header;
+  uint64_t timestamp, tick = 0, value;
+  int deadlines, firstSample = 1, numberOfChannels = 1, readTerminal;
+
+  if(channelList != NULL && channels_parse(&channels, channelList) < 0)
+  {
+    perror("[-] ERROR: Invalid channel list");
+    if(errno == EINVAL)
+    {
+      print_usage(argv[0]);
+    }
+    return 1;
+  }
+  if(channels.keyLanes && inputPath == NULL)
   {
-    printf("[-] ERROR: Insufficient number of arguments.");
-    printf("[!] Usage: %s <output file> <number of samples>\n", argv[0]);
+    printf("[-] ERROR: Key channels need an evdev device, give it with -i.\n");
     return 1;
   }
+  if(channelList != NULL)
+  {
+    numberOfChannels = channels.numberOfChannels;
+  }
+  // Without a channel list the single lane is any key, of the device or of the terminal
+  recorder.keyLanes = channelList != NULL ? channels.keyLanes : 1;
+  readTerminal = inputPath == NULL && channelList == NULL;
 
-  char *outputFilename = argv[1];
-  int numberOfSamples = atoi(argv[2]);
-  FILE *outputFile = fopen(outputFilename, "w");
+  outputDescriptor = open(outputFilename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(outputDescriptor < 0)
+  {
+    printf("[-] ERROR: Could not open %s\n", outputFilename);
+    return 1;
+  }
 
-  if(outputFilename == NULL)
+  // The samples only go into memory here, the writer thread does the I/O
+  outputFile = async_writer_open(&asyncWriter, outputDescriptor, DefaultRingSizeInBytes);
+  if(outputFile == NULL)
   {
-    printf("[-] ERROR: Could not open %s", outputFilename);
+    perror("[-] ERROR: Could not start the writer thread");
+    close(outputDescriptor);
     return 1;
   }
+  // Text samples reach the ring a line at a time, so a full ring loses whole samples, seen as missing timestamps
+  if(!writeEdges && !writeWords)
+  {
+    setvbuf(outputFile, NULL, _IOLBF, 0);
+  }
 
-  enable_raw_mode();
+  if(inputPath != NULL &&
+     evdev_open(&input, inputPath, channels.keyCodeOfLane, channelList != NULL ? channels.numberOfChannels : 0) < 0)
+  {
+    perror("[-] ERROR: Could not open the input device");
+    fclose(outputFile);
+    return 1;
+  }
+
+  if(sampler_start(&sampler, sampleRateInHz) < 0)
+  {
+    perror("[-] ERROR: Could not start the sample timer");
+    if(inputPath != NULL)
+    {
+      evdev_close(&input);
+    }
+    fclose(outputFile);
+    return 1;
+  }
+  recorder.periodInNanoSec = sampler.periodInNanoSec;
+
+  if(readTerminal)
+  {
+    enable_raw_mode();
+  }
 
+  // One "<CLOCK_MONOTONIC ns> <value>" line per sample, missed deadlines leave a gap in the timestamps.
+  // The binary formats count sample periods instead, where a missed deadline is just a skipped tick.
+  // Every lane is read at the same tick, so the channels stay aligned.
   while(numberOfSamples > 0)
   {
-    if(key_pressed())
+    deadlines = sampler_wait(&sampler, &timestamp);
+    if(deadlines < 0)
+    {
+      break;
+    }
+
+    // The first sample is tick 0, the ones after it land deadlines ticks later
+    if(!firstSample)
+    {
+      tick += deadlines;
+    }
+
+    value = channels_read_lines(&channels);
+    if(inputPath != NULL)
+    {
+      // In an edge capture the key edges are written as they are read, at their own timestamps
+      if(evdev_poll(&input, writeEdges ? record_edge : NULL, &recorder) < 0)
+      {
+        perror("[-] ERROR: Lost the input device");
+        break;
+      }
+      value |= evdev_sample(&input) & recorder.keyLanes;
+    }
+    else if(readTerminal && key_pressed())
     {
       discard_data();
-      fprintf(outputFile, "1\n");
+      value = 1;
+    }
+
+    if(!writeEdges && !writeWords)
+    {
+      if(numberOfChannels == 1)
+      {
+        fprintf(outputFile, "%" PRIu64 " %d\n", timestamp, (int)value);
+      }
+      else
+      {
+        fprintf(outputFile, "%" PRIu64 " %016" PRIx64 "\n", timestamp, value);
+      }
+    }
+    else if(firstSample)
+    {
+      // Keys down at the first sample are the initial value, not edges
+      if(writeEdges && inputPath != NULL)
+      {
+        value = (value & ~recorder.keyLanes) | (input.lanesDown & recorder.keyLanes);
+      }
+      header.numberOfChannels = numberOfChannels;
+      header.sampleRateInHz = sampleRateInHz;
+      header.encoding = writeWords ? WaveEncodingWords : WaveEncodingChanges;
+      header.startTimestampInNanoSec = timestamp;
+      header.initialValue = value;
+      recorder.startTimestamp = timestamp;
+      recorder.started = 1;
+      // Records go to the ring one by one, so a full ring loses whole records and leaves a gap record
+      wave_writer_open(&recorder.writer, outputFile, &header, &asyncWriter.droppedWrites);
+    }
+    else if(writeEdges && inputPath != NULL)
+    {
+      // The key lanes are already written, only the lines change here
+      wave_writer_sample(&recorder.writer, tick,
+                         (value & ~recorder.keyLanes) | (recorder.writer.value & recorder.keyLanes));
     }
     else
     {
-      fprintf(outputFile, "0\n");
+      wave_writer_sample(&recorder.writer, tick, value);
     }
 
-    numberOfSamples--;
-    sleep(DelayTimeInSeconds);
+    // Missed deadlines still count, so the capture lasts as long as requested
+    numberOfSamples -= deadlines;
+    firstSample = 0;
   }
 
-  disable_raw_mode();
+  if(inputPath != NULL)
+  {
+    evdev_close(&input);
+  }
+  if(readTerminal)
+  {
+    disable_raw_mode();
+  }
+  channels_close(&channels);
 
+  if((writeEdges || writeWords) && !firstSample)
+  {
+    wave_writer_close(&recorder.writer, tick);
+  }
+
+  sampler_stop(&sampler);
   fclose(outputFile);
-  printf("Done Processing %s\n", outputFilename);
+  if(asyncWriter.writeError)
+  {
+    printf("[-] ERROR: Writing %s failed: %s\n", outputFilename, strerror(asyncWriter.writeError));
+  }
+  if(asyncWriter.droppedBytes)
+  {
+    printf("[-] ERROR: Storage fell behind, %" PRIu64 " bytes of output were dropped%s\n", asyncWriter.droppedBytes,
+           writeEdges || writeWords ? ", the capture marks the gaps" : " as whole samples");
+  }
+  printf("Done Processing %s, %" PRIu64 " missed deadlines\n", outputFilename, sampler.numberOfOverruns);
 
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,682 @@
+#include <string.h>
+#include "WaveFormat.h"
+
+enum
+{
+  WaveWriterEndAttempts = 1000        ///< Tries at the gap record in front of the end marker
+};
+
+static void put_little_endian(uint8_t *buffer, uint64_t value, int size)
+{
+  for(int i = 0; i < size; i++)
+  {
+    buffer[i] = value >> (8 * i);
+  }
+}
+
+static uint64_t get_little_endian(const uint8_t *buffer, int size)
+{
+  uint64_t value = 0;
+
+  for(int i = size - 1; i >= 0; i--)
+  {
+    value = (value << 8) | buffer[i];
+  }
+
+  return value;
+}
+
+static int put_varint(FILE *file, uint64_t value)
+{
+  uint8_t buffer[10];
+  size_t size = 0;
+
+  do
+  {
+    buffer[size] = value & 0x7f;
+    value >>= 7;
+    if(value)
+    {
+      buffer[size] |= 0x80;
+    }
+    size++;
+  } while(value);
+
+  return fwrite(buffer, 1, size, file) == size ? 0 : -1;
+}
+
+/**
+ * Reads one varint.
+ * Returns 1, 0 at the end of the file, or -1 for a truncated or oversized one.
+ */
+static int get_varint(FILE *file, uint64_t *value)
+{
+  int byte, shift = 0;
+
+  *value = 0;
+  while((byte = getc_unlocked(file)) != EOF)
+  {
+    if(shift > 63)
+    {
+      return -1;
+    }
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if(!(byte & 0x80))
+    {
+      return 1;
+    }
+    shift += 7;
+  }
+
+  return shift == 0 ? 0 : -1;
+}
+
+static int put_word(FILE *file, uint64_t value)
+{
+  uint8_t buffer[8];
+
+  put_little_endian(buffer, value, sizeof(buffer));
+
+  return fwrite(buffer, 1, sizeof(buffer), file) == sizeof(buffer) ? 0 : -1;
+}
+
+/**
+ * Reads one little endian word.
+ * Returns 1, or 0 at the end of the file or in a truncated word.
+ */
+static int get_word(FILE *file, uint64_t *value)
+{
+  uint8_t buffer[8];
+
+  if(fread(buffer, 1, sizeof(buffer), file) != sizeof(buffer))
+  {
+    return 0;
+  }
+  *value = get_little_endian(buffer, sizeof(buffer));
+
+  return 1;
+}
+
+/**
+ * Bits an edge needs for its channel number.
+ */
+static int channel_bits(unsigned int numberOfChannels)
+{
+  int bits = 0;
+
+  while((1U << bits) < numberOfChannels)
+  {
+    bits++;
+  }
+
+  return bits;
+}
+
+static uint64_t channel_mask(unsigned int numberOfChannels)
+{
+  return numberOfChannels >= 64 ? UINT64_MAX : (1ULL << numberOfChannels) - 1;
+}
+
+/**
+ * Ends a record. When the output can drop writes, every record is flushed
+ * on its own, so it is either kept or dropped whole, and a dropped one
+ * makes the next record a gap record.
+ */
+static int end_record(wave_writer_t *writer)
+{
+  if(writer->droppedWrites == NULL)
+  {
+    return 0;
+  }
+  if(fflush(writer->file) != 0)
+  {
+    return -1;
+  }
+  if(*writer->droppedWrites != writer->knownDroppedWrites)
+  {
+    writer->knownDroppedWrites = *writer->droppedWrites;
+    writer->gapPending = 1;
+  }
+
+  return 0;
+}
+
+/**
+ * Writes a sample word, twice if it could be taken for the escape.
+ */
+static int put_sample_word(FILE *file, uint64_t value)
+{
+  if(put_word(file, value) < 0)
+  {
+    return -1;
+  }
+
+  return value == WAVE_FORMAT_ESCAPE ? put_word(file, value) : 0;
+}
+
+/**
+ * Before a record: after lost records, writes where the capture picks up
+ * again, the tick of the last edge or word and the value of every channel.
+ * A record must not follow a gap record that was lost too, since it only
+ * holds the change from the state before it; it is skipped instead, and
+ * the next gap record covers it.
+ * Returns 1 if the record can be written, 0 if it has to be skipped, or -1.
+ */
+static int begin_record(wave_writer_t *writer)
+{
+  int status;
+
+  if(!writer->gapPending)
+  {
+    return 1;
+  }
+  writer->gapPending = 0;
+
+  if(writer->encoding == WaveEncodingWords)
+  {
+    status = put_word(writer->file, WAVE_FORMAT_ESCAPE) < 0 || put_word(writer->file, writer->lastTick) < 0 ||
+             put_word(writer->file, writer->value) < 0;
+  }
+  else
+  {
+    status = put_varint(writer->file, 0) < 0 || put_varint(writer->file, (writer->lastTick << 1) | 1) < 0 ||
+             put_varint(writer->file, writer->value) < 0;
+  }
+  if(status || end_record(writer) < 0)
+  {
+    return -1;
+  }
+
+  return !writer->gapPending;
+}
+
+/**
+ * Writes the word of the tick after the last one.
+ */
+static int put_next_word(wave_writer_t *writer, uint64_t value)
+{
+  int status = begin_record(writer);
+
+  if(status < 0 || (status > 0 && put_sample_word(writer->file, value) < 0))
+  {
+    return -1;
+  }
+  writer->lastTick++;
+  writer->value = value;
+
+  return status > 0 ? end_record(writer) : 0;
+}
+
+/**
+ * Writes the header of a capture. header->initialValue is the first
+ * sample, at tick 0. droppedWrites, if not NULL, counts the writes file
+ * drops whole when it cannot keep up, such as an AsyncWriter stream; lost
+ * records are then followed by a gap record instead of corrupting the rest.
+ */
+int wave_writer_open(wave_writer_t *writer, FILE *file, const wave_header_t *header, const uint64_t *droppedWrites)
+{
+  uint8_t buffer[WaveFormatHeaderSize] = { 0 };
+
+  memcpy(buffer, WAVE_FORMAT_MAGIC, 4);
+  put_little_endian(buffer + 4, WaveFormatVersion, 2);
+  put_little_endian(buffer + 6, header->numberOfChannels, 2);
+  put_little_endian(buffer + 8, header->sampleRateInHz, 4);
+  buffer[12] = header->encoding;
+  put_little_endian(buffer + 16, header->startTimestampInNanoSec, 8);
+  put_little_endian(buffer + 24, header->initialValue, 8);
+
+  memset(writer, 0, sizeof(*writer));
+  writer->file = file;
+  writer->encoding = header->encoding;
+  writer->channelBits = channel_bits(header->numberOfChannels);
+  writer->channelMask = channel_mask(header->numberOfChannels);
+  writer->value = header->initialValue & writer->channelMask;
+  writer->droppedWrites = droppedWrites;
+  if(droppedWrites != NULL)
+  {
+    writer->knownDroppedWrites = *droppedWrites;
+  }
+
+  if(fwrite(buffer, 1, sizeof(buffer), file) != sizeof(buffer) ||
+     (writer->encoding == WaveEncodingWords && put_sample_word(file, writer->value) < 0))
+  {
+    return -1;
+  }
+
+  // Nothing came before the header that a gap record could pick up from
+  if(end_record(writer) < 0)
+  {
+    return -1;
+  }
+  writer->gapPending = 0;
+
+  return 0;
+}
+
+/**
+ * Records the value of every channel tick periods after the first sample.
+ *
+ * With change records only the channels that changed write anything. A
+ * change at or before an earlier edge of the same channel, such as the
+ * release of a press shorter than a period, is moved one period after it
+ * so neither edge is lost.
+ *
+ * With words every tick since the previous one is written, the skipped
+ * ones with the previous value. Ticks that were written already are
+ * ignored.
+ */
+int wave_writer_sample(wave_writer_t *writer, uint64_t tick, uint64_t value)
+{
+  uint64_t changes;
+
+  value &= writer->channelMask;
+
+  if(writer->encoding == WaveEncodingWords)
+  {
+    if(tick <= writer->lastTick)
+    {
+      return 0;
+    }
+    while(writer->lastTick + 1 < tick)
+    {
+      if(put_next_word(writer, writer->value) < 0)
+      {
+        return -1;
+      }
+    }
+    return put_next_word(writer, value);
+  }
+
+  for(changes = value ^ writer->value; changes; changes &= changes - 1)
+  {
+    int channel = __builtin_ctzll(changes);
+    uint64_t edgeTick = tick;
+    int status;
+
+    if(edgeTick <= writer->lastTickOfChannel[channel])
+    {
+      edgeTick = writer->lastTickOfChannel[channel] + 1;
+    }
+    if(edgeTick < writer->lastTick)
+    {
+      edgeTick = writer->lastTick;
+    }
+
+    status = begin_record(writer);
+    if(status < 0 ||
+       (status > 0 &&
+        put_varint(writer->file, (((edgeTick - writer->lastTick) << writer->channelBits) | channel) + 1) < 0))
+    {
+      return -1;
+    }
+    writer->lastTick = edgeTick;
+    writer->lastTickOfChannel[channel] = edgeTick;
+    // Flipped edge by edge, so a gap record in between has the value so far
+    writer->value ^= 1ULL << channel;
+    if(status > 0 && end_record(writer) < 0)
+    {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Ends the capture at lastTick, the tick of the last sample.
+ */
+int wave_writer_close(wave_writer_t *writer, uint64_t lastTick)
+{
+  int status;
+
+  if(writer->encoding == WaveEncodingWords)
+  {
+    while(writer->lastTick < lastTick)
+    {
+      if(put_next_word(writer, writer->value) < 0)
+      {
+        return -1;
+      }
+    }
+    // The last words were lost, a gap record still tells where the capture ends
+    if(begin_record(writer) < 0)
+    {
+      return -1;
+    }
+    return fflush(writer->file);
+  }
+
+  if(lastTick < writer->lastTick)
+  {
+    lastTick = writer->lastTick;
+  }
+  // Nothing follows the end marker to carry a lost gap record, so it is tried again while the stream
+  // drains. Without it the marker would end at the wrong tick, the capture then ends at its last record.
+  status = 0;
+  for(int attempt = 0; attempt < WaveWriterEndAttempts && status == 0; attempt++)
+  {
+    status = begin_record(writer);
+  }
+  if(status < 0 ||
+     (status > 0 &&
+      (put_varint(writer->file, 0) < 0 || put_varint(writer->file, (lastTick - writer->lastTick) << 1) < 0)))
+  {
+    return -1;
+  }
+
+  return fflush(writer->file);
+}
+
+/**
+ * Reads and checks the header of a capture.
+ * Returns 0, or -1 if file is not a capture this reader understands.
+ */
+int wave_reader_open(wave_reader_t *reader, FILE *file)
+{
+  uint8_t buffer[WaveFormatHeaderSize];
+  wave_header_t *header = &reader->header;
+
+  memset(reader, 0, sizeof(*reader));
+  if(fread(buffer, 1, WaveFormatVersion1HeaderSize, file) != WaveFormatVersion1HeaderSize ||
+     memcmp(buffer, WAVE_FORMAT_MAGIC, 4))
+  {
+    return -1;
+  }
+
+  header->version = get_little_endian(buffer + 4, 2);
+  header->numberOfChannels = get_little_endian(buffer + 6, 2);
+  header->sampleRateInHz = get_little_endian(buffer + 8, 4);
+  header->startTimestampInNanoSec = get_little_endian(buffer + 16, 8);
+  if(header->version == 1)
+  {
+    header->encoding = WaveEncodingChanges;
+    header->initialValue = buffer[12] & 1;
+  }
+  else if(header->version == 2 || header->version == WaveFormatVersion)
+  {
+    if(fread(buffer + WaveFormatVersion1HeaderSize, 1, WaveFormatHeaderSize - WaveFormatVersion1HeaderSize, file) !=
+       WaveFormatHeaderSize - WaveFormatVersion1HeaderSize)
+    {
+      return -1;
+    }
+    header->encoding = buffer[12];
+    header->initialValue = get_little_endian(buffer + 24, 8);
+  }
+  else
+  {
+    return -1;
+  }
+  if(header->numberOfChannels == 0 || header->numberOfChannels > WaveMaximumChannels ||
+     (header->version == 1 && header->numberOfChannels != 1) ||
+     header->encoding > WaveEncodingWords || header->sampleRateInHz == 0)
+  {
+    return -1;
+  }
+
+  reader->file = file;
+  reader->channelBits = channel_bits(header->numberOfChannels);
+  reader->value = header->initialValue & channel_mask(header->numberOfChannels);
+
+  // The first word is the sample at tick 0, the same as the initial value
+  if(header->encoding == WaveEncodingWords)
+  {
+    uint64_t word;
+
+    if(get_word(file, &word) <= 0 ||
+       (header->version >= 3 && word == WAVE_FORMAT_ESCAPE && get_word(file, &word) <= 0))
+    {
+      return -1;
+    }
+    reader->value = word & channel_mask(header->numberOfChannels);
+  }
+
+  return 0;
+}
+
+/**
+ * Returns the next of the channels that changed at the current tick.
+ */
+static int next_pending(wave_reader_t *reader, wave_edge_t *edge)
+{
+  int channel = __builtin_ctzll(reader->pendingChanges);
+
+  reader->pendingChanges &= reader->pendingChanges - 1;
+  edge->tick = reader->tick;
+  edge->channel = channel;
+  edge->value = (reader->value >> channel) & 1;
+
+  return 1;
+}
+
+/**
+ * Picks the capture up again at tick with every channel at value after a
+ * gap. Every channel is then returned as an edge at tick, and edge->tick is
+ * the first tick whose value was lost.
+ */
+static int resume_after_gap(wave_reader_t *reader, uint64_t tick, uint64_t value, wave_edge_t *edge)
+{
+  if(tick < reader->tick)
+  {
+    return -1;
+  }
+
+  // A word holds a whole tick, but a lost change can be at the tick of the last one read
+  edge->tick = reader->tick;
+  if(reader->header.encoding == WaveEncodingWords && reader->tick < tick)
+  {
+    edge->tick++;
+  }
+  edge->channel = 0;
+  edge->value = 0;
+  reader->tick = tick;
+  reader->value = value & channel_mask(reader->header.numberOfChannels);
+  reader->pendingChanges = channel_mask(reader->header.numberOfChannels);
+
+  return WaveReaderGap;
+}
+
+static int next_change(wave_reader_t *reader, wave_edge_t *edge)
+{
+  uint64_t record, delta, value;
+  int channel = 0;
+  int status;
+
+  status = get_varint(reader->file, &record);
+  if(status <= 0)
+  {
+    // No end marker, the capture ends at its last edge
+    reader->ended = 1;
+    reader->endTick = reader->tick;
+    return status;
+  }
+
+  if(record == 0)
+  {
+    if(get_varint(reader->file, &delta) <= 0)
+    {
+      reader->ended = 1;
+      return -1;
+    }
+    if(reader->header.version >= 3)
+    {
+      if(delta & 1)
+      {
+        // A truncated gap record is a capture that ends at its last edge
+        if(get_varint(reader->file, &value) <= 0)
+        {
+          reader->ended = 1;
+          reader->endTick = reader->tick;
+          return 0;
+        }
+        return resume_after_gap(reader, delta >> 1, value, edge);
+      }
+      delta >>= 1;
+    }
+    reader->ended = 1;
+    reader->endTick = reader->tick + delta;
+    return 0;
+  }
+
+  // Version 1 stored the bare delta, with the channel always 0
+  if(reader->header.version == 1)
+  {
+    delta = record;
+  }
+  else
+  {
+    delta = (record - 1) >> reader->channelBits;
+    channel = (record - 1) & ((1ULL << reader->channelBits) - 1);
+  }
+  if(channel >= reader->header.numberOfChannels)
+  {
+    return -1;
+  }
+
+  reader->tick += delta;
+  reader->value ^= 1ULL << channel;
+  edge->tick = reader->tick;
+  edge->channel = channel;
+  edge->value = (reader->value >> channel) & 1;
+
+  return 1;
+}
+
+static int next_word_change(wave_reader_t *reader, wave_edge_t *edge)
+{
+  uint64_t mask = channel_mask(reader->header.numberOfChannels);
+  uint64_t word, tick;
+
+  while(reader->pendingChanges == 0)
+  {
+    if(get_word(reader->file, &word) <= 0)
+    {
+      reader->ended = 1;
+      reader->endTick = reader->tick;
+      return 0;
+    }
+    if(reader->header.version >= 3 && word == WAVE_FORMAT_ESCAPE)
+    {
+      // A truncated escape or gap ends the capture at the last word
+      if(get_word(reader->file, &word) <= 0 ||
+         (word != WAVE_FORMAT_ESCAPE && get_word(reader->file, &tick) <= 0))
+      {
+        reader->ended = 1;
+        reader->endTick = reader->tick;
+        return 0;
+      }
+      if(word != WAVE_FORMAT_ESCAPE)
+      {
+        return resume_after_gap(reader, word, tick, edge);
+      }
+    }
+    reader->tick++;
+    reader->pendingChanges = (word ^ reader->value) & mask;
+    reader->value = word & mask;
+  }
+
+  return next_pending(reader, edge);
+}
+
+/**
+ * Streams the next edge out of the capture without loading it. Edges come
+ * in tick order, several channels can change at the same tick.
+ * Returns 1 with edge filled in, WaveReaderGap where records were lost,
+ * 0 at the end of the capture, or -1 if it is corrupt. After a gap,
+ * edge->tick is the first tick whose value is unknown, and the next calls
+ * return every channel as an edge at the tick the capture picks up again.
+ */
+int wave_reader_next(wave_reader_t *reader, wave_edge_t *edge)
+{
+  // The channels that changed at one tick, or every channel after a gap
+  if(reader->pendingChanges != 0)
+  {
+    return next_pending(reader, edge);
+  }
+  if(reader->ended)
+  {
+    return 0;
+  }
+
+  if(reader->header.encoding == WaveEncodingWords)
+  {
+    return next_word_change(reader, edge);
+  }
+
+  return next_change(reader, edge);
+}
+
+/**
+ * Converts a tick into nanoseconds since the first sample, with the same
+ * whole nanosecond period the sampler used.
+ */
+uint64_t wave_tick_to_ns(const wave_header_t *header, uint64_t tick)
+{
+  return tick * (1000000000ULL / header->sampleRateInHz);
+}
+
+/**
+ * Converts a capture into a Value Change Dump with one 1 bit signal per
+ * channel, named lane0, lane1 and so on, with nanosecond times counted
+ * from the first sample.
+ * Returns 0, or -1 if the capture is not valid.
+ */
+int wave_export_vcd(FILE *capture, FILE *vcd)
+{
+  wave_reader_t reader;
+  wave_edge_t edge;
+  uint64_t lastTick = 0;
+  int status, channel;
+
+  if(wave_reader_open(&reader, capture) < 0)
+  {
+    return -1;
+  }
+
+  fprintf(vcd, "$version Wave capture at %u Hz $end\n", reader.header.sampleRateInHz);
+  fprintf(vcd, "$timescale 1 ns $end\n");
+  fprintf(vcd, "$scope module wave $end\n");
+  for(channel = 0; channel < reader.header.numberOfChannels; channel++)
+  {
+    // Identifiers are single printable characters starting at '!'
+    fprintf(vcd, "$var wire 1 %c lane%d $end\n", '!' + channel, channel);
+  }
+  fprintf(vcd, "$upscope $end\n");
+  fprintf(vcd, "$enddefinitions $end\n");
+  fprintf(vcd, "#0\n$dumpvars\n");
+  for(channel = 0; channel < reader.header.numberOfChannels; channel++)
+  {
+    fprintf(vcd, "%u%c\n", (unsigned int)(reader.value >> channel) & 1, '!' + channel);
+  }
+  fprintf(vcd, "$end\n");
+
+  while((status = wave_reader_next(&reader, &edge)) > 0)
+  {
+    if(edge.tick != lastTick)
+    {
+      fprintf(vcd, "#%llu\n", (unsigned long long)wave_tick_to_ns(&reader.header, edge.tick));
+      lastTick = edge.tick;
+    }
+    if(status == WaveReaderGap)
+    {
+      // Unknown until the edges at the tick the capture picks up again
+      for(channel = 0; channel < reader.header.numberOfChannels; channel++)
+      {
+        fprintf(vcd, "x%c\n", '!' + channel);
+      }
+      continue;
+    }
+    fprintf(vcd, "%u%c\n", edge.value, '!' + edge.channel);
+  }
+  if(status < 0)
+  {
+    return -1;
+  }
+
+  // Viewers show the last values up to the last timestamp
+  if(reader.endTick > lastTick)
+  {
+    fprintf(vcd, "#%llu\n", (unsigned long long)wave_tick_to_ns(&reader.header, reader.endTick));
+  }
+
+  return 0;
+}
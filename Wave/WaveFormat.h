@@ -0,0 +1,111 @@
+#ifndef WAVE_FORMAT_H
+#define WAVE_FORMAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * Binary capture format for up to 64 channels sampled on one timer. A
+ * capture is a header followed by the samples in one of two encodings:
+ *
+ * WaveEncodingChanges stores only the edges. Every edge is an unsigned
+ * LEB128 varint of ((ticks since the previous edge << channelBits) | channel) + 1,
+ * where channelBits is the number of bits needed for numberOfChannels - 1
+ * (0 for a single channel), and flips that channel. A key held for a second
+ * at 1 kHz is two bytes instead of two thousand. A zero varint is followed
+ * by a varint of (ticks << 1) | gap: without gap it marks the end of the
+ * capture, ticks being the number between the last edge and the last
+ * sample. A capture cut short by a crash just ends after its last edge.
+ *
+ * WaveEncodingWords stores every sample as a little endian 64 bit word with
+ * channel i in bit i, which costs the same however busy the signals are. A
+ * sample equal to WAVE_FORMAT_ESCAPE is written twice; the escape followed
+ * by any other word starts a gap.
+ *
+ * Records the output had to drop (see AsyncWriter.h) are followed by a gap
+ * record: the absolute tick of the last record, lost ones included, then
+ * the value of every channel at that tick, as a varint or as a word. The
+ * channels are unknown between the last record before the gap and that
+ * tick, and the records after it carry on from there.
+ *
+ * Version 1 captures (one channel, only edges, a 24 byte header) and
+ * version 2 captures (the same as now without gaps) can still be read. All
+ * header fields are little endian.
+ */
+
+#define WAVE_FORMAT_MAGIC "WAVE"
+#define WAVE_FORMAT_ESCAPE 0x5041475f45564157ULL   ///< "WAVE_GAP" in a little endian word
+
+enum
+{
+  WaveFormatVersion = 3,
+  WaveFormatHeaderSize = 32,
+  WaveFormatVersion1HeaderSize = 24,
+  WaveMaximumChannels = 64
+};
+
+enum
+{
+  WaveEncodingChanges = 0,
+  WaveEncodingWords = 1
+};
+
+enum
+{
+  WaveReaderGap = 2                   ///< wave_reader_next() result for lost records
+};
+
+typedef struct wave_header_t
+{
+  uint16_t version;
+  uint16_t numberOfChannels;
+  uint32_t sampleRateInHz;
+  uint8_t encoding;                   ///< WaveEncodingChanges or WaveEncodingWords
+  uint64_t startTimestampInNanoSec;   ///< CLOCK_MONOTONIC time of the first sample
+  uint64_t initialValue;              ///< Channel i of the first sample in bit i
+} wave_header_t;
+
+typedef struct wave_writer_t
+{
+  FILE *file;
+  uint8_t encoding;
+  int channelBits;
+  uint64_t channelMask;
+  uint64_t value;
+  uint64_t lastTick;                  ///< Tick of the last edge, or of the last word
+  uint64_t lastTickOfChannel[WaveMaximumChannels];
+  const uint64_t *droppedWrites;      ///< Writes the output dropped whole, NULL if it never drops
+  uint64_t knownDroppedWrites;
+  int gapPending;                     ///< A record was lost, the next one is a gap record
+} wave_writer_t;
+
+typedef struct wave_edge_t
+{
+  uint64_t tick;                      ///< Sample periods since the first sample
+  uint8_t channel;
+  uint8_t value;                      ///< Value of the channel from this tick on
+} wave_edge_t;
+
+typedef struct wave_reader_t
+{
+  FILE *file;
+  wave_header_t header;
+  int channelBits;
+  uint64_t tick;
+  uint64_t value;                     ///< All channels after the last edge returned
+  uint64_t pendingChanges;            ///< Words encoding: channels of the current word not returned yet
+  int ended;                          ///< Set once the end of the capture was reached
+  uint64_t endTick;                   ///< Tick of the last sample, valid once ended is set
+} wave_reader_t;
+
+int wave_writer_open(wave_writer_t *writer, FILE *file, const wave_header_t *header, const uint64_t *droppedWrites);
+int wave_writer_sample(wave_writer_t *writer, uint64_t tick, uint64_t value);
+int wave_writer_close(wave_writer_t *writer, uint64_t lastTick);
+
+int wave_reader_open(wave_reader_t *reader, FILE *file);
+int wave_reader_next(wave_reader_t *reader, wave_edge_t *edge);
+uint64_t wave_tick_to_ns(const wave_header_t *header, uint64_t tick);
+
+int wave_export_vcd(FILE *capture, FILE *vcd);
+
+#endif
@@ -0,0 +1,305 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "WaveFormat.h"
+
+/**
+ * Checks that binary captures survive lost records. Every capture is
+ * written through a stream that drops writes the way a full AsyncWriter
+ * ring does, then read back: every tick outside a gap must hold the value
+ * that was written. The drop patterns lose single records, two records in
+ * a row (so gap records get lost too) and records at random.
+ */
+
+enum
+{
+  NumberOfTicks = 20000,
+  RandomRounds = 10
+};
+
+typedef enum drop_pattern_t
+{
+  DropNothing,
+  DropEverySeventh,
+  DropPairs,              ///< Two writes in a row out of every five
+  DropAtRandom,           ///< About one write in three
+  DropBurstsAtRandom,     ///< Runs of up to four writes
+  NumberOfDropPatterns
+} drop_pattern_t;
+
+static const char *dropPatternNames[NumberOfDropPatterns] =
+{
+  "nothing", "every 7th", "pairs", "random", "random bursts"
+};
+
+typedef struct capture_t
+{
+  char *data;
+  size_t size;
+  size_t capacity;
+  drop_pattern_t pattern;
+  uint64_t numberOfWrites;
+  uint64_t droppedWrites;
+  int burstLeft;
+} capture_t;
+
+static uint64_t values[NumberOfTicks];
+static uint64_t decodedValues[NumberOfTicks];
+static uint8_t unknownTicks[NumberOfTicks];
+
+static int drop_write(capture_t *capture)
+{
+  uint64_t write = capture->numberOfWrites++;
+
+  // The header always fits, the ring is empty when a capture starts
+  if(write == 0)
+  {
+    return 0;
+  }
+
+  switch(capture->pattern)
+  {
+    case DropEverySeventh:
+      return write % 7 == 0;
+    case DropPairs:
+      return write % 5 == 3 || write % 5 == 4;
+    case DropAtRandom:
+      return rand() % 3 == 0;
+    case DropBurstsAtRandom:
+      if(capture->burstLeft == 0 && rand() % 8 == 0)
+      {
+        capture->burstLeft = 1 + rand() % 4;
+      }
+      if(capture->burstLeft > 0)
+      {
+        capture->burstLeft--;
+        return 1;
+      }
+      return 0;
+    default:
+      return 0;
+  }
+}
+
+static ssize_t capture_write(void *cookie, const char *buffer, size_t size)
+{
+  capture_t *capture = cookie;
+  char *data;
+
+  if(drop_write(capture))
+  {
+    capture->droppedWrites++;
+    return size;
+  }
+
+  if(capture->size + size > capture->capacity)
+  {
+    size_t capacity = 2 * (capture->size + size);
+
+    data = realloc(capture->data, capacity);
+    if(data == NULL)
+    {
+      return -1;
+    }
+    capture->data = data;
+    capture->capacity = capacity;
+  }
+  memcpy(capture->data + capture->size, buffer, size);
+  capture->size += size;
+
+  return size;
+}
+
+/**
+ * Writes values[] as a capture with the given pattern of lost writes.
+ * Returns 0, or -1.
+ */
+static int write_capture(capture_t *capture, int numberOfChannels, int encoding)
+{
+  cookie_io_functions_t functions = { .write = capture_write };
+  wave_header_t header = { .numberOfChannels = numberOfChannels, .sampleRateInHz = 1000, .encoding = encoding };
+  wave_writer_t writer;
+  FILE *file = fopencookie(capture, "w", functions);
+  int status;
+
+  if(file == NULL)
+  {
+    return -1;
+  }
+  header.initialValue = values[0];
+  status = wave_writer_open(&writer, file, &header, &capture->droppedWrites);
+  for(int tick = 1; tick < NumberOfTicks && status == 0; tick++)
+  {
+    status = wave_writer_sample(&writer, tick, values[tick]);
+  }
+  if(status == 0)
+  {
+    status = wave_writer_close(&writer, NumberOfTicks - 1);
+  }
+  fclose(file);
+
+  return status;
+}
+
+static void fill_ticks(uint64_t from, uint64_t to, uint64_t value, int unknown)
+{
+  for(uint64_t tick = from; tick < to && tick < NumberOfTicks; tick++)
+  {
+    decodedValues[tick] = value;
+    unknownTicks[tick] = unknown;
+  }
+}
+
+/**
+ * Reads a capture back into decodedValues[] and unknownTicks[].
+ * Returns the number of ticks it covers, or -1 if it is corrupt.
+ */
+static int64_t read_capture(const capture_t *capture, int *numberOfGaps)
+{
+  FILE *file = fmemopen(capture->data, capture->size, "rb");
+  wave_reader_t reader;
+  wave_edge_t edge;
+  uint64_t tick = 0, value;
+  int status;
+
+  *numberOfGaps = 0;
+  if(file == NULL || wave_reader_open(&reader, file) < 0)
+  {
+    if(file != NULL)
+    {
+      fclose(file);
+    }
+    return -1;
+  }
+  value = reader.value;
+
+  while((status = wave_reader_next(&reader, &edge)) > 0)
+  {
+    if(status == WaveReaderGap)
+    {
+      // Known up to the gap, unknown until the tick every channel is given again
+      fill_ticks(tick, edge.tick, value, 0);
+      fill_ticks(edge.tick, reader.tick, value, 1);
+      (*numberOfGaps)++;
+      tick = reader.tick;
+      continue;
+    }
+    if(edge.tick > tick)
+    {
+      fill_ticks(tick, edge.tick, value, 0);
+      tick = edge.tick;
+    }
+    value = edge.value ? value | (1ULL << edge.channel) : value & ~(1ULL << edge.channel);
+  }
+  fclose(file);
+  if(status < 0)
+  {
+    return -1;
+  }
+  fill_ticks(tick, reader.endTick + 1, value, 0);
+
+  return reader.endTick + 1;
+}
+
+/**
+ * Writes and reads back one capture.
+ * Returns the number of failed checks.
+ */
+static int check_capture(int numberOfChannels, int encoding, drop_pattern_t pattern)
+{
+  uint64_t mask = numberOfChannels >= 64 ? UINT64_MAX : (1ULL << numberOfChannels) - 1;
+  capture_t capture = { .pattern = pattern };
+  int64_t numberOfTicks;
+  int numberOfGaps, wrongTicks = 0;
+  uint64_t value = 0;
+
+  for(int tick = 0; tick < NumberOfTicks; tick++)
+  {
+    // Bursts of changes on several channels at once, and quiet stretches
+    if(rand() % 4 == 0)
+    {
+      value ^= (uint64_t)rand() << 32 | rand();
+      value ^= 1ULL << (rand() % numberOfChannels);
+    }
+    values[tick] = value & mask;
+  }
+  // A sample equal to the escape word must not be taken for a gap
+  if(numberOfChannels == 64)
+  {
+    values[NumberOfTicks / 2] = WAVE_FORMAT_ESCAPE;
+  }
+
+  memset(unknownTicks, 1, sizeof(unknownTicks));
+  if(write_capture(&capture, numberOfChannels, encoding) < 0)
+  {
+    printf("[-] ERROR: Could not write a %d channel capture\n", numberOfChannels);
+    free(capture.data);
+    return 1;
+  }
+  numberOfTicks = read_capture(&capture, &numberOfGaps);
+  free(capture.data);
+  if(numberOfTicks < 0)
+  {
+    printf("[-] ERROR: %d channels, %s encoding, dropping %s: corrupt capture\n", numberOfChannels,
+           encoding == WaveEncodingWords ? "words" : "changes", dropPatternNames[pattern]);
+    return 1;
+  }
+
+  for(int64_t tick = 0; tick < numberOfTicks && tick < NumberOfTicks; tick++)
+  {
+    if(!unknownTicks[tick] && decodedValues[tick] != values[tick])
+    {
+      wrongTicks++;
+    }
+  }
+
+  if(wrongTicks > 0 || (pattern == DropNothing && (numberOfGaps > 0 || numberOfTicks != NumberOfTicks)) ||
+     (capture.droppedWrites > 0 && numberOfGaps == 0))
+  {
+    printf("[-] ERROR: %d channels, %s encoding, dropping %s: %d ticks outside gaps wrong, "
+           "%d gaps for %" PRIu64 " lost writes, %" PRId64 " ticks\n", numberOfChannels,
+           encoding == WaveEncodingWords ? "words" : "changes", dropPatternNames[pattern], wrongTicks, numberOfGaps,
+           capture.droppedWrites, numberOfTicks);
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(void)
+{
+  static const int channelCounts[] = { 1, 3, 8, 64 };
+  int failures = 0, checks = 0;
+
+  srand(1);
+  for(int round = 0; round < RandomRounds; round++)
+  {
+    for(size_t i = 0; i < sizeof(channelCounts) / sizeof(channelCounts[0]); i++)
+    {
+      for(int encoding = WaveEncodingChanges; encoding <= WaveEncodingWords; encoding++)
+      {
+        for(int pattern = 0; pattern < NumberOfDropPatterns; pattern++)
+        {
+          // The fixed patterns come out the same every round
+          if(round > 0 && pattern != DropAtRandom && pattern != DropBurstsAtRandom)
+          {
+            continue;
+          }
+          failures += check_capture(channelCounts[i], encoding, pattern);
+          checks++;
+        }
+      }
+    }
+  }
+
+  if(failures > 0)
+  {
+    printf("[-] ERROR: %d of %d captures decoded wrong\n", failures, checks);
+    return 1;
+  }
+  printf("[+] %d captures with lost writes decode right outside their gaps\n", checks);
+
+  return 0;
+}